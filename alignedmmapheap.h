@@ -4,6 +4,7 @@
 #define _ALIGNEDMMAPHEAP_H_
 
 #include "vamcommon.h"
+#include "latencyhistogram.h"
 
 #include "mapsizeheap.h"
 #include "mmapheap.h"
@@ -26,6 +27,7 @@ public:
 		if (size == 0 || (size & ~PAGE_MASK) != 0 || alignment == 0 || (alignment & ~PAGE_MASK) != 0)
 			return NULL;
 
+		LatencyTimer timer(LATENCY_MMAP);
 		size_t start = reinterpret_cast<size_t>(PrivateMmapHeap::malloc(size + alignment));
 		abort_on(start == 0);
 
@@ -42,6 +44,11 @@ public:
 		return reinterpret_cast<void *>(ptr);
 	}
 
+	inline void free(void * ptr) {
+		LatencyTimer timer(LATENCY_MUNMAP);
+		MapSizeHeap<PrivateMmapHeap>::free(ptr);
+	}
+
 };	//end of class AlignedMmapHeap
 
 // TheOneAlignedMmapHeap: singleton of AlignedMmapHeap
@@ -14,27 +14,39 @@ class BitmapCachingReap : public ReapBase {
 
 public:
 
-	BitmapCachingReap(size_t size, size_t object_size) {
+	// with space, the objects take all of it and only we and the bitmap live at this
+	BitmapCachingReap(size_t size, size_t object_size, bool zeroed = false, void * space = NULL, unsigned int color = 0) {
+		size_t start = reinterpret_cast<size_t>(space != NULL ? space : this);
+
 		// calculate the bitmap size in bytes
-		size_t max_num_objects = (size - sizeof(*this)) / object_size;
-		size_t bitmap_size = (max_num_objects + SIZE_T_BIT - 1) / SIZE_T_BIT * sizeof(size_t);
+		size_t bitmap_size = getMapSize(space != NULL ? size : size - sizeof(*this), object_size);
 
-		// the bitmap is right after us
+		// the bitmap is right after us, it is already clear in a subheap known to be zero unless it lives elsewhere
 		_bitmap = reinterpret_cast<size_t *>(this + 1);
-		memset(_bitmap, 0, bitmap_size);
+		if (!zeroed || space != NULL)
+			memset(_bitmap, 0, bitmap_size);
 
-		// the allocation base is right after the bitmap
-		size_t base_ptr = (reinterpret_cast<size_t>(_bitmap) + bitmap_size + sizeof(double) - 1) & ~(sizeof(double) - 1);
+		// the allocation base is right after the bitmap or at the start of space, aligned for the object size and colored
+		size_t base_ptr = alignBasePtr(space != NULL ? start : reinterpret_cast<size_t>(_bitmap) + bitmap_size, object_size);
+		base_ptr = colorBasePtr(base_ptr, start + size, object_size, color);
 		assert(base_ptr % sizeof(double) == 0);
 
 		// calculate the number of allocable objects
-		size_t num_total = (reinterpret_cast<size_t>(this) + size - base_ptr) / object_size;
-		initReapBase(object_size, num_total, num_total, base_ptr);
+		size_t num_total = (start + size - base_ptr) / object_size;
+		initReapBase(object_size, num_total, num_total, base_ptr, zeroed);
 		_lowest_bit = num_total;
 
+		// the cache holds object indices, which must fit in its entries
+		assert(num_total <= 0xFFFF);
+
 		_num_cached = 0;
 	}
 
+	// the bytes of bitmap for the objects of object_size that fit in size bytes
+	inline static size_t getMapSize(size_t size, size_t object_size) {
+		return (size / object_size + SIZE_T_BIT - 1) / SIZE_T_BIT * sizeof(size_t);
+	}
+
 	inline void * malloc() {
 		void * ptr = ReapBase::malloc();
 
@@ -42,7 +54,7 @@ public:
 			if (_num_cached > 0) {
 				// allocate from the cache
 				assert(_num_cached <= CACHE_SIZE);
-				ptr = reinterpret_cast<void *>(_base_ptr + _cached_offsets[--_num_cached]);
+				ptr = reinterpret_cast<void *>(_base_ptr + _object_size * _cached_indices[--_num_cached]);
 			}
 			else {
 				// refill the cache
@@ -62,7 +74,7 @@ public:
 					if (mask & (1UL << (SIZE_T_BIT - 1))) {
 						assert(offset < _num_total);
 						assert(_num_cached < CACHE_SIZE);
-						_cached_offsets[_num_cached++] = _object_size * offset;
+						_cached_indices[_num_cached++] = offset;
 					}
 
 					mask <<= 1;
@@ -73,7 +85,7 @@ public:
 				assert(_num_cached > 0);
 				assert(_num_cached <= _num_free);
 
-				ptr = reinterpret_cast<void *>(_base_ptr + _cached_offsets[--_num_cached]);
+				ptr = reinterpret_cast<void *>(_base_ptr + _object_size * _cached_indices[--_num_cached]);
 			}
 
 			_num_free--;
@@ -82,24 +94,56 @@ public:
 		return ptr;
 	}
 
+	// allocate up to n objects from the bump space, then the cache, then whole bitmap words
+	inline size_t mallocBatch(void ** ptrs, size_t n) {
+		size_t num = ReapBase::mallocBatch(ptrs, n);
+
+		while (num < n && _num_cached > 0) {
+			ptrs[num++] = reinterpret_cast<void *>(_base_ptr + _object_size * _cached_indices[--_num_cached]);
+			_num_free--;
+		}
+
+		while (num < n && _num_free > 0) {
+			// find the first non-zero word of the bitmap
+			size_t * bm;
+			for (bm = _bitmap + _lowest_bit / SIZE_T_BIT; !*bm; bm++);
+
+			// take the free objects of this word in address order
+			size_t mask = 1;
+			size_t offset = (bm - _bitmap) * SIZE_T_BIT;
+			while (*bm && num < n) {
+				if (*bm & mask) {
+					assert(offset < _num_total);
+					*bm ^= mask;
+					ptrs[num++] = reinterpret_cast<void *>(_base_ptr + _object_size * offset);
+					_num_free--;
+				}
+				mask <<= 1;
+				offset++;
+			}
+			_lowest_bit = offset;
+		}
+
+		return num;
+	}
+
 	inline void free(void * ptr) {
 		assert(_num_free < _num_total);
 		assert(_num_cached < CACHE_SIZE);
 		assert((reinterpret_cast<size_t>(ptr) - _base_ptr) % _object_size == 0);
 
 		// put the free object into the cache
-		_cached_offsets[_num_cached++] = reinterpret_cast<size_t>(ptr) - _base_ptr;
+		_cached_indices[_num_cached++] = offsetToIndex(reinterpret_cast<size_t>(ptr) - _base_ptr);
 
 		// empty the cache if it's full
 		if (_num_cached == CACHE_SIZE) {
 
 			for (size_t i = 0; i < CACHE_SIZE; i++) {
-				size_t offset = _cached_offsets[i] / _object_size;
-				assert(_cached_offsets[i] % _object_size == 0);
+				size_t offset = _cached_indices[i];
 				assert(offset >= 0 && offset < _num_total);
-				assert((_bitmap[offset / SIZE_T_BIT] & (1 << (offset % SIZE_T_BIT))) == 0);
+				assert((_bitmap[offset / SIZE_T_BIT] & (1UL << (offset % SIZE_T_BIT))) == 0);
 
-				_bitmap[offset / SIZE_T_BIT] |= 1 << (offset % SIZE_T_BIT);
+				_bitmap[offset / SIZE_T_BIT] |= 1UL << (offset % SIZE_T_BIT);
 
 				if (offset < _lowest_bit)
 					_lowest_bit = offset;
@@ -127,7 +171,7 @@ private:
 	size_t * _bitmap;
 	size_t _lowest_bit;
 	size_t _num_cached;
-	unsigned short _cached_offsets[CACHE_SIZE];
+	unsigned short _cached_indices[CACHE_SIZE];
 	list_head _list;
 
 };	// end of class BitmapCachingReap
@@ -9,65 +9,133 @@
 
 namespace VAM {
 
-// BitmapReap: a reap that uses a bitmap to recycle freed objects
+// the orders in which a BitmapReap reuses freed objects, BitmapCachingReap reuses the most recently freed ones first
+enum {
+	LOWEST_FIRST,		// the bump space first, then the freed object with the lowest address
+	ADDRESS_ORDERED,	// always the lowest address, freed objects are all below the bump space
+	CLUSTERED,			// the freed objects in the page of the last one reused first, then the lowest
+};
+
+// BitmapReap: a reap that uses a bitmap to recycle freed objects in the given order
+template<int Order = LOWEST_FIRST>
 class BitmapReap : public ReapBase {
 
 public:
 
-	BitmapReap(size_t size, size_t object_size) {
+	// with space, the objects take all of it and only we and the bitmap live at this
+	BitmapReap(size_t size, size_t object_size, bool zeroed = false, void * space = NULL, unsigned int color = 0) {
+		size_t start = reinterpret_cast<size_t>(space != NULL ? space : this);
+
 		// calculate the bitmap size in bytes
-		size_t max_num_objects = (size - sizeof(*this)) / object_size;
-		size_t bitmap_size = (max_num_objects + SIZE_T_BIT - 1) / SIZE_T_BIT * sizeof(size_t);
+		size_t bitmap_size = getMapSize(space != NULL ? size : size - sizeof(*this), object_size);
 
-		// the bitmap is right after us
+		// the bitmap is right after us, it is already clear in a subheap known to be zero unless it lives elsewhere
 		_bitmap = reinterpret_cast<size_t *>(this + 1);
-		memset(_bitmap, 0, bitmap_size);
+		if (!zeroed || space != NULL)
+			memset(_bitmap, 0, bitmap_size);
 
-		// the allocation base is right after the bitmap
-		size_t base_ptr = (reinterpret_cast<size_t>(_bitmap) + bitmap_size + sizeof(double) - 1) & ~(sizeof(double) - 1);
+		// the allocation base is right after the bitmap or at the start of space, aligned for the object size and colored
+		size_t base_ptr = alignBasePtr(space != NULL ? start : reinterpret_cast<size_t>(_bitmap) + bitmap_size, object_size);
+		base_ptr = colorBasePtr(base_ptr, start + size, object_size, color);
 		assert(base_ptr % sizeof(double) == 0);
 
 		// calculate the number of allocable objects
-		size_t num_total = (reinterpret_cast<size_t>(this) + size - base_ptr) / object_size;
-		initReapBase(object_size, num_total, num_total, base_ptr);
+		size_t num_total = (start + size - base_ptr) / object_size;
+		initReapBase(object_size, num_total, num_total, base_ptr, zeroed);
 		_lowest_bit = num_total;
+		_last_bit = 0;
+	}
+
+	// the bytes of bitmap for the objects of object_size that fit in size bytes
+	inline static size_t getMapSize(size_t size, size_t object_size) {
+		return (size / object_size + SIZE_T_BIT - 1) / SIZE_T_BIT * sizeof(size_t);
 	}
 
 	inline void * malloc() {
-		void * ptr = ReapBase::malloc();
+		void * ptr = NULL;
+		if (Order != ADDRESS_ORDERED || _num_free == getNumUnbumped())
+			ptr = ReapBase::malloc();
 
 		if (ptr == NULL && _num_free > 0) {
+			size_t offset = _num_total;
+			if (Order == CLUSTERED)
+				offset = findFreeBit(pageToBit(_last_bit), pageToBit(_last_bit, 1));
+
+			if (offset == _num_total) {
+				// find the first non-zero word of the bitmap
+				size_t * bm;
+				for (bm = _bitmap + _lowest_bit / SIZE_T_BIT; !*bm; bm++);
+
+				// find the bit that indicates the first free object
+				size_t mask = 1;
+				offset = (bm - _bitmap) * SIZE_T_BIT;
+				while (!(*bm & mask)) {
+					mask <<= 1;
+					offset++;
+				}
+				_lowest_bit = offset + 1;
+			}
+
+			assert(offset < _num_total);
+			assert(_bitmap[offset / SIZE_T_BIT] & (1UL << (offset % SIZE_T_BIT)));
+			_bitmap[offset / SIZE_T_BIT] ^= 1UL << (offset % SIZE_T_BIT);
+
+			ptr = reinterpret_cast<void *>(_base_ptr + _object_size * offset);
+			_last_bit = offset;
+
+			_num_free--;
+		}
+
+		return ptr;
+	}
+
+	// allocate up to n objects, taking whole bitmap words once the bump space is used up,
+	// or before touching it when allocating in address order
+	inline size_t mallocBatch(void ** ptrs, size_t n) {
+		size_t num = 0;
+		if (Order != ADDRESS_ORDERED)
+			num = ReapBase::mallocBatch(ptrs, n);
+
+		while (num < n && _num_free > getNumUnbumped()) {
 			// find the first non-zero word of the bitmap
 			size_t * bm;
 			for (bm = _bitmap + _lowest_bit / SIZE_T_BIT; !*bm; bm++);
 
-			// find the bit that indicates the first free object and clear it
+			// take the free objects of this word in address order
 			size_t mask = 1;
 			size_t offset = (bm - _bitmap) * SIZE_T_BIT;
-			while (!(*bm & mask)) {
+			while (*bm && num < n) {
+				if (*bm & mask) {
+					assert(offset < _num_total);
+					*bm ^= mask;
+					ptrs[num++] = reinterpret_cast<void *>(_base_ptr + _object_size * offset);
+					_num_free--;
+				}
 				mask <<= 1;
 				offset++;
 			}
-			assert(offset < _num_total);
-			*bm ^= mask;
+			_lowest_bit = offset;
+		}
 
-			ptr = reinterpret_cast<void *>(_base_ptr + _object_size * offset);
-			_lowest_bit = offset + 1;
+		if (Order == ADDRESS_ORDERED)
+			num += ReapBase::mallocBatch(ptrs + num, n - num);
 
-			_num_free--;
-		}
+		return num;
+	}
 
-		return ptr;
+	// in address order, the freed objects below the bump space are reused before it
+	inline bool nextIsZero() {
+		return ReapBase::nextIsZero() && (Order != ADDRESS_ORDERED || _num_free == getNumUnbumped());
 	}
 
 	inline void free(void * ptr) {
 		assert(_num_free < _num_total);
 		assert((reinterpret_cast<size_t>(ptr) - _base_ptr) % _object_size == 0);
 
-		size_t offset = (reinterpret_cast<size_t>(ptr) - _base_ptr) / _object_size;
+		size_t offset = offsetToIndex(reinterpret_cast<size_t>(ptr) - _base_ptr);
 		assert(offset >= 0 && offset < _num_total);
-		assert((_bitmap[offset / SIZE_T_BIT] & (1 << (offset % SIZE_T_BIT))) == 0);
-		_bitmap[offset / SIZE_T_BIT] |= 1 << (offset % SIZE_T_BIT);
+		assert((_bitmap[offset / SIZE_T_BIT] & (1UL << (offset % SIZE_T_BIT))) == 0);
+		_bitmap[offset / SIZE_T_BIT] |= 1UL << (offset % SIZE_T_BIT);
 
 		_num_free++;
 
@@ -87,8 +155,32 @@ private:
 
 	size_t * _bitmap;
 	size_t _lowest_bit;
+	size_t _last_bit;	// the object reused last
 	list_head _list;
 
+	// the first object starting in the page of the given one, or in the page after it with page = 1
+	inline size_t pageToBit(size_t offset, size_t page = 0) {
+		size_t page_ptr = ((_base_ptr + _object_size * offset) & PAGE_MASK) + page * PAGE_SIZE;
+		if (page_ptr <= _base_ptr)
+			return 0;
+
+		size_t bit = (page_ptr - _base_ptr + _object_size - 1) / _object_size;
+		return bit < _num_total ? bit : _num_total;
+	}
+
+	// the first free object in [from, to), or _num_total if there is none
+	inline size_t findFreeBit(size_t from, size_t to) {
+		while (from < to) {
+			size_t word = _bitmap[from / SIZE_T_BIT] >> (from % SIZE_T_BIT);
+			if (word) {
+				size_t offset = from + __builtin_ctzl(word);
+				return offset < to ? offset : _num_total;
+			}
+			from = (from / SIZE_T_BIT + 1) * SIZE_T_BIT;
+		}
+		return _num_total;
+	}
+
 };	// end of class BitmapReap
 
 };	// end of namespace VAM
@@ -14,25 +14,34 @@ class BytemapReap : public ReapBase {
 
 public:
 
-	BytemapReap(size_t size, size_t object_size) {
+	// with space, the objects take all of it and only we and the bytemap live at this
+	BytemapReap(size_t size, size_t object_size, bool zeroed = false, void * space = NULL, unsigned int color = 0) {
+		size_t start = reinterpret_cast<size_t>(space != NULL ? space : this);
+
 		// calculate the bytemap size in bytes
-		size_t max_num_objects = (size - sizeof(*this)) / object_size;
-		size_t bytemap_size = max_num_objects * sizeof(*_bytemap);
+		size_t bytemap_size = getMapSize(space != NULL ? size : size - sizeof(*this), object_size);
 
-		// the bytemap is right after us
+		// the bytemap is right after us, it is already clear in a subheap known to be zero unless it lives elsewhere
 		_bytemap = reinterpret_cast<unsigned char *>(this + 1);
-		memset(_bytemap, 0, bytemap_size);
+		if (!zeroed || space != NULL)
+			memset(_bytemap, 0, bytemap_size);
 
-		// the allocation base is right after the bytemap
-		size_t base_ptr = (reinterpret_cast<size_t>(_bytemap) + bytemap_size + sizeof(double) - 1) & ~(sizeof(double) - 1);
+		// the allocation base is right after the bytemap or at the start of space, aligned for the object size and colored
+		size_t base_ptr = alignBasePtr(space != NULL ? start : reinterpret_cast<size_t>(_bytemap) + bytemap_size, object_size);
+		base_ptr = colorBasePtr(base_ptr, start + size, object_size, color);
 		assert(base_ptr % sizeof(double) == 0);
 
 		// calculate the number of allocable objects
-		size_t num_total = (reinterpret_cast<size_t>(this) + size - base_ptr) / object_size;
-		initReapBase(object_size, num_total, num_total, base_ptr);
+		size_t num_total = (start + size - base_ptr) / object_size;
+		initReapBase(object_size, num_total, num_total, base_ptr, zeroed);
 		_lowest_byte = num_total;
 	}
 
+	// the bytes of bytemap for the objects of object_size that fit in size bytes
+	inline static size_t getMapSize(size_t size, size_t object_size) {
+		return size / object_size * sizeof(unsigned char);
+	}
+
 	inline void * malloc() {
 		void * ptr = ReapBase::malloc();
 
@@ -54,11 +63,22 @@ public:
 		return ptr;
 	}
 
+	// allocate up to n objects and return the number allocated
+	inline size_t mallocBatch(void ** ptrs, size_t n) {
+		size_t num = ReapBase::mallocBatch(ptrs, n);
+
+		while (num < n && _num_free > 0) {
+			ptrs[num++] = malloc();
+		}
+
+		return num;
+	}
+
 	inline void free(void * ptr) {
 		assert(_num_free < _num_total);
 		assert((reinterpret_cast<size_t>(ptr) - _base_ptr) % _object_size == 0);
 
-		size_t offset = (reinterpret_cast<size_t>(ptr) - _base_ptr) / _object_size;
+		size_t offset = offsetToIndex(reinterpret_cast<size_t>(ptr) - _base_ptr);
 		assert(offset >= 0 && offset < _num_total);
 		assert(_bytemap[offset] == 0);
 		_bytemap[offset] = 1;
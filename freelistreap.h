@@ -14,18 +14,27 @@ class FreelistReap : public ReapBase {
 
 public:
 
-	FreelistReap(size_t size, size_t object_size) {
-		// the allocation base is right after us
-		size_t base_ptr = (reinterpret_cast<size_t>(this + 1) + sizeof(double) - 1) & ~(sizeof(double) - 1);
+	// with space, the objects take all of it and only we live at this
+	FreelistReap(size_t size, size_t object_size, bool zeroed = false, void * space = NULL, unsigned int color = 0) {
+		size_t start = reinterpret_cast<size_t>(space != NULL ? space : this);
+
+		// the allocation base is right after us or at the start of space, aligned for the object size and colored
+		size_t base_ptr = alignBasePtr(space != NULL ? start : reinterpret_cast<size_t>(this + 1), object_size);
+		base_ptr = colorBasePtr(base_ptr, start + size, object_size, color);
 		assert(base_ptr % sizeof(double) == 0);
 
 		// calculate the number of allocable objects
-		size_t num_total = (size - sizeof(*this)) / object_size;
+		size_t num_total = (start + size - base_ptr) / object_size;
 
-		initReapBase(object_size, num_total, num_total, base_ptr);
+		initReapBase(object_size, num_total, num_total, base_ptr, zeroed);
 		_freelist = NULL;
 	}
 
+	// the freelist lives in the free objects themselves
+	inline static size_t getMapSize(size_t, size_t) {
+		return 0;
+	}
+
 	inline void * malloc() {
 		void * ptr = ReapBase::malloc();
 
@@ -39,6 +48,17 @@ public:
 		return ptr;
 	}
 
+	// allocate up to n objects and return the number allocated
+	inline size_t mallocBatch(void ** ptrs, size_t n) {
+		size_t num = ReapBase::mallocBatch(ptrs, n);
+
+		while (num < n && _num_free > 0) {
+			ptrs[num++] = malloc();
+		}
+
+		return num;
+	}
+
 	inline void free(void * ptr) {
 		assert(_num_free < _num_total);
 		assert((reinterpret_cast<size_t>(ptr) - _base_ptr) % _object_size == 0);
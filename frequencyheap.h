@@ -3,42 +3,66 @@
 #ifndef _FREQUENCYHEAP_H_
 #define _FREQUENCYHEAP_H_
 
+#include <algorithm>
+
+#include "vamcommon.h"
+#include "popularity.h"
+#include "sizeclasses.h"
+#include "mapsizeheap.h"
+#include "heapprofiler.h"
+
 namespace VAM {
 
-// FrequencyHeap: a heap that segregates objects by their allocation frequency
-template<size_t MaxFreqSize, bool (*highFreqReached)(size_t size, size_t count), class LowFreqHeap, class HighFreqHeap>
+// cumulative counts of a size class, summed over threads once they fold their counts in
+struct ClassTotals {
+	size_t allocs;		// allocations requested, from either heap
+	size_t frees;		// frees of objects in dedicated subheaps
+};
+
+// what FrequencyHeap counts besides the size classes
+struct FrequencyStats {
+	size_t low_freq_allocs;
+	size_t low_freq_frees;
+	long low_freq_bytes;	// live bytes in the low frequency heap
+	size_t promotions;
+	size_t demotions;
+};
+
+// FrequencyHeap: a heap that segregates objects by the allocation frequency of their size classes, as judged by PopularityPolicy
+template<class SizeClasses, class PopularityPolicy, class LowFreqHeap, class HighFreqHeap>
 class FrequencyHeap : public HighFreqHeap {
 
   public:
-	FrequencyHeap() {
-		dbprintf("FrequencyHeap: sizeof(_frequent_sizes)=%u sizeof(_size_counts)=%u\n", sizeof(_frequent_sizes), sizeof(_size_counts));
-		memset(_frequent_sizes, 0, sizeof(_frequent_sizes));
-		memset(_size_counts, 0, sizeof(_size_counts));
+	FrequencyHeap() : _epoch_allocs(0) {
+		dbprintf("FrequencyHeap: sizeof(_popular)=%u sizeof(_stats)=%u\n", sizeof(_popular), sizeof(_stats));
+		memset(_popular, 0, sizeof(_popular));
+		memset(_stats, 0, sizeof(_stats));
+		memset(_totals, 0, sizeof(_totals));
+		memset(&_frequency_stats, 0, sizeof(_frequency_stats));
 	}
 
 	inline void * malloc(size_t size) {
 		void * ptr = NULL;
 #if 1
-		size_t index = SIZE_TO_INDEX(size);
-
-		if (size <= MaxFreqSize) {
-			if (_frequent_sizes[index]) {
-				ptr = HighFreqHeap::malloc(size);
-				assert(HighFreqHeap::ptrToType(ptr) != LOW_FREQ_TYPE);
-			}
-			else if (highFreqReached(size, ++_size_counts[index])) {
-				_frequent_sizes[index] = true;
-				ptr = HighFreqHeap::malloc(size);
-				assert(HighFreqHeap::ptrToType(ptr) != LOW_FREQ_TYPE);
-			}
+		LocalCounts * local = countAllocations(size, 1);
+		if (local != NULL) {
+			ptr = HighFreqHeap::malloc(size);
+			assert(HighFreqHeap::ptrToType(ptr) != LOW_FREQ_TYPE);
+			if (ptr != NULL)
+				local->live++;
 		}
 
 		if (ptr == NULL) {
-			ptr = _low_freq_heap.malloc(size);
+			ptr = _low_freq_heap.malloc(getRoundedSize(size));
 			assert(HighFreqHeap::ptrToType(ptr) == LOW_FREQ_TYPE);
+			if (ptr != NULL)
+				countLowFreq(1, 0, getRoundedSize(size));
 		}
+
+		if (ptr != NULL)
+			_profiler.countBytes(ptr, size);
 #else
-		if (size <= MaxFreqSize) {
+		if (size <= SizeClasses::MAX_SIZE) {
 			ptr = HighFreqHeap::malloc(size);
 			assert(HighFreqHeap::ptrToType(ptr) != LOW_FREQ_TYPE);
 		}
@@ -50,17 +74,180 @@ class FrequencyHeap : public HighFreqHeap {
 		return ptr;
 	}
 
+	// allocate a zeroed object, letting the heaps skip clearing memory known to be zero
+	inline void * calloc(size_t size) {
+		void * ptr = NULL;
+
+		LocalCounts * local = countAllocations(size, 1);
+		if (local != NULL) {
+			ptr = HighFreqHeap::calloc(size);
+			assert(HighFreqHeap::ptrToType(ptr) != LOW_FREQ_TYPE);
+			if (ptr != NULL)
+				local->live++;
+		}
+
+		if (ptr == NULL) {
+			ptr = _low_freq_heap.calloc(getRoundedSize(size));
+			assert(HighFreqHeap::ptrToType(ptr) == LOW_FREQ_TYPE);
+			if (ptr != NULL)
+				countLowFreq(1, 0, getRoundedSize(size));
+		}
+
+		if (ptr != NULL)
+			_profiler.countBytes(ptr, size);
+
+		return ptr;
+	}
+
+	// resize an object, in place if it still fits or the low frequency heap can grow it
+	inline void * realloc(void * ptr, size_t size) {
+		if (ptr == NULL)
+			return malloc(size);
+
+		size_t old_size;
+		if (HighFreqHeap::ptrToType(ptr) == LOW_FREQ_TYPE) {
+			old_size = _low_freq_heap.getSize(ptr);
+			if (_low_freq_heap.resize(ptr, size)) {
+				countLowFreq(0, 0, static_cast<long>(_low_freq_heap.getSize(ptr)) - static_cast<long>(old_size));
+				return ptr;
+			}
+		}
+		else {
+			// a shrinking object stays only in its own size class, which a later sized free looks it up by
+			old_size = HighFreqHeap::getSize(ptr);
+			if (size <= old_size && SizeClasses::sizeToIndex(size) == SizeClasses::sizeToIndex(old_size))
+				return ptr;
+		}
+
+		void * new_ptr = malloc(size);
+		if (new_ptr != NULL) {
+			memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+			free(ptr);
+		}
+
+		return new_ptr;
+	}
+
+	// allocate an aligned object, from a size class whose objects are naturally aligned if possible
+	inline void * memalign(size_t alignment, size_t size) {
+		void * ptr = NULL;
+		size_t aligned_size = (size + alignment - 1) & ~(alignment - 1);
+
+		// subheaps align their objects to a page at most
+		if (aligned_size <= SizeClasses::MAX_SIZE && alignment <= PAGE_SIZE) {
+			ptr = HighFreqHeap::malloc(aligned_size);
+			assert(reinterpret_cast<size_t>(ptr) % alignment == 0);
+			if (ptr != NULL)
+				_local_counts[SizeClasses::sizeToIndex(aligned_size)].live++;
+		}
+
+		if (ptr == NULL) {
+			ptr = _low_freq_heap.memalign(alignment, size);
+			assert(ptr == NULL || reinterpret_cast<size_t>(ptr) % alignment == 0);
+			if (ptr != NULL)
+				countLowFreq(1, 0, _low_freq_heap.getSize(ptr));
+		}
+
+		if (ptr != NULL)
+			_profiler.countBytes(ptr, size);
+
+		return ptr;
+	}
+
+	// allocate up to n objects of the same size and return the number allocated
+	inline size_t mallocBatch(size_t size, void ** ptrs, size_t n) {
+		size_t num = 0;
+
+		// the whole batch counts towards the popularity of the size class
+		LocalCounts * local = countAllocations(size, n);
+		if (local != NULL) {
+			num = HighFreqHeap::mallocBatch(size, ptrs, n);
+			local->live += num;
+		}
+
+		for (; num < n; num++) {
+			ptrs[num] = _low_freq_heap.malloc(getRoundedSize(size));
+			if (ptrs[num] == NULL)
+				break;
+			assert(HighFreqHeap::ptrToType(ptrs[num]) == LOW_FREQ_TYPE);
+			countLowFreq(1, 0, getRoundedSize(size));
+		}
+
+		for (size_t i = 0; i < num; i++)
+			_profiler.countBytes(ptrs[i], size);
+
+		return num;
+	}
+
+	// free n objects, the array is sorted by address so that objects in the same subheap are freed together
+	inline void freeBatch(void ** ptrs, size_t n) {
+		std::sort(ptrs, ptrs + n, PtrCmp());
+
+		size_t i = 0;
+		while (i < n) {
+			if (ptrs[i] == NULL) {
+				i++;
+				continue;
+			}
+
+			_profiler.forget(ptrs[i]);
+
+			if (HighFreqHeap::ptrToType(ptrs[i]) == LOW_FREQ_TYPE) {
+				freeLowFreq(ptrs[i++]);
+				continue;
+			}
+
+			// hand down adjacent objects of the same size in one batch
+			size_t size = HighFreqHeap::getSize(ptrs[i]);
+			size_t j = i + 1;
+			while (j < n && HighFreqHeap::ptrToType(ptrs[j]) != LOW_FREQ_TYPE && HighFreqHeap::getSize(ptrs[j]) == size)
+				_profiler.forget(ptrs[j++]);
+
+			HighFreqHeap::freeBatch(ptrs + i, j - i);
+			countFrees(size, j - i);
+			i = j;
+		}
+	}
+
 	inline void free(void * ptr) {
+		_profiler.forget(ptr);
+		unsigned char type = HighFreqHeap::ptrToType(ptr);
+
+		if (type == LOW_FREQ_TYPE) {
+			freeLowFreq(ptr);
+		}
+		else {
+			// look up the size once, for the statistics and the sized free below
+			size_t size = HighFreqHeap::getSize(ptr);
+			countFrees(size, 1);
+			freeHighFreq(ptr, size);
+		}
+	}
+
+	// free with the size supplied by the caller, which picks the size class and so must be that of the object
+	inline void free(void * ptr, size_t size) {
+		_profiler.forget(ptr);
 		unsigned char type = HighFreqHeap::ptrToType(ptr);
 
 		if (type == LOW_FREQ_TYPE) {
-			_low_freq_heap.free(ptr);
+			freeLowFreq(ptr);
 		}
 		else {
-			HighFreqHeap::free(ptr);
+			abort_on(size > SizeClasses::MAX_SIZE
+				|| SizeClasses::sizeToIndex(size) != SizeClasses::sizeToIndex(HighFreqHeap::getSize(ptr)));
+			countFrees(size, 1);
+			freeHighFreq(ptr, size);
 		}
 	}
 
+	// the usable size of an object allocated for the requested size, the low frequency heap is asked for the same rounded size
+	inline size_t getRoundedSize(size_t size) {
+		if (size <= SizeClasses::MAX_SIZE)
+			return HighFreqHeap::getRoundedSize(size);
+		else
+			return size;
+	}
+
 	inline size_t getSize(void * ptr) {
 		unsigned char type = HighFreqHeap::ptrToType(ptr);
 
@@ -72,15 +259,288 @@ class FrequencyHeap : public HighFreqHeap {
 		}
 	}
 
+	// statistics, which lack the counts other threads have not folded in yet, fewer than FOLD_COUNT per size class each
+
+	inline bool isPopular(size_t index) {
+		return _popular[index];
+	}
+
+	inline const PopularityStats & getPopularityStats(size_t index) {
+		return _stats[index];
+	}
+
+	inline const ClassTotals & getClassTotals(size_t index) {
+		return _totals[index];
+	}
+
+	inline const FrequencyStats & getFrequencyStats() {
+		return _frequency_stats;
+	}
+
+	// fold in all counts of the calling thread, so that its own recent allocations and frees show in the statistics
+	void foldLocalCounts() {
+		for (size_t index = 0; index < SizeClasses::NUM_CLASSES; index++) {
+			if (_local_counts[index].allocs != 0 || _local_counts[index].live != 0 || _local_counts[index].frees != 0)
+				fold(index);
+		}
+		foldLowFreq();
+	}
+
+	// sample about one allocation every rate bytes for the heap profile, 0 stops sampling
+	void setSampleRate(size_t rate) {
+		_profiler.setRate(rate);
+	}
+
+	// write the sampled objects that are still live as a heap profile for pprof, this does not allocate
+	bool dumpSamples(const char * path) {
+		int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+		if (fd < 0)
+			return false;
+
+		bool ok = _profiler.dump(fd);
+		close(fd);
+		return ok;
+	}
+
+	// write a "size popular allocs live" line for each size class that has been used
+	bool saveProfile(const char * path) {
+		int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+		if (fd < 0)
+			return false;
+
+		bool ok = true;
+		for (size_t index = 0; index < SizeClasses::NUM_CLASSES; index++) {
+			PopularityStats * stats = &_stats[index];
+			if (stats->allocs == 0 && stats->live == 0 && !_popular[index])
+				continue;
+
+			char line[PROFILE_LINE_SIZE];
+			int n = snprintf(line, sizeof(line), "%lu %d %lu %ld\n", (unsigned long) SizeClasses::indexToSize(index), _popular[index] ? 1 : 0, (unsigned long) stats->allocs, stats->live);
+			if (write(fd, line, n) != n)
+				ok = false;
+		}
+
+		close(fd);
+		return ok;
+	}
+
+	// promote the size classes that were popular when the profile was saved, and take over their counts
+	bool loadProfile(const char * path) {
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		// read in chunks without calling malloc(), carrying over the partial line at the end of each chunk
+		char buf[PROFILE_LINE_SIZE * 16];
+		size_t len = 0;
+		ssize_t n;
+		while ((n = read(fd, buf + len, sizeof(buf) - 1 - len)) > 0) {
+			len += n;
+			buf[len] = 0;
+
+			char * line = buf;
+			char * end;
+			while ((end = strchr(line, '\n')) != NULL) {
+				*end = 0;
+				loadProfileLine(line);
+				line = end + 1;
+			}
+
+			len -= line - buf;
+			memmove(buf, line, len);
+			if (len == sizeof(buf) - 1)
+				len = 0;
+		}
+		if (n == 0 && len > 0) {
+			buf[len] = 0;
+			loadProfileLine(buf);
+		}
+
+		close(fd);
+		return n == 0;
+	}
+
   private:
 
-	bool _frequent_sizes[SIZE_TO_INDEX(MaxFreqSize) + 1];
-	size_t _size_counts[SIZE_TO_INDEX(MaxFreqSize) + 1];
+	enum {
+		FOLD_COUNT = 8,
+		CACHE_LINE_SIZE = 64,
+		PROFILE_LINE_SIZE = 64,
+		SAMPLE_DEPTH = 16,
+	};
+
+	// counts of this thread not yet folded into _stats and _totals
+	struct LocalCounts {
+		long allocs;
+		long live;
+		long frees;
+	};
+
+	// counts of this thread not yet folded into _frequency_stats
+	struct LowFreqCounts {
+		long allocs;
+		long frees;
+		long bytes;
+	};
+
+	// read on every small allocation and written only on promotion or demotion, so it stays in the caches of all cores
+	bool _popular[SizeClasses::NUM_CLASSES];
+	char _padding[CACHE_LINE_SIZE];
+
+	// updated atomically by the threads folding their counts
+	PopularityStats _stats[SizeClasses::NUM_CLASSES];
+	size_t _epoch_allocs;		// allocations folded in since the start, an epoch ends at every EPOCH_LENGTH of them
+	ClassTotals _totals[SizeClasses::NUM_CLASSES];
+	FrequencyStats _frequency_stats;
+
+	static __thread LocalCounts _local_counts[SizeClasses::NUM_CLASSES];
+	static __thread LowFreqCounts _local_low_freq;
+	static __thread size_t _demotions_seen;
 
 	LowFreqHeap _low_freq_heap;
+	HeapProfiler<SAMPLE_DEPTH> _profiler;
+
+	// count n allocations in this thread, and return its counts of their size class if it is popular enough for dedicated subheaps
+	inline LocalCounts * countAllocations(size_t size, size_t n) {
+		if (size > SizeClasses::MAX_SIZE)
+			return NULL;
+
+		size_t index = SizeClasses::sizeToIndex(size);
+		LocalCounts * local = &_local_counts[index];
+		local->allocs += n;
+		if (local->allocs >= FOLD_COUNT)
+			fold(index);
+
+		return _popular[index] ? local : NULL;
+	}
+
+	inline void countFrees(size_t size, size_t n) {
+		size_t index = SizeClasses::sizeToIndex(size);
+		LocalCounts * local = &_local_counts[index];
+		local->live -= n;
+		local->frees += n;
+		if (local->live <= -FOLD_COUNT)
+			fold(index);
+	}
+
+	// objects of size classes that are no longer popular bypass the thread caches, which would keep them from their subheaps
+	inline void freeHighFreq(void * ptr, size_t size) {
+		if (_popular[SizeClasses::sizeToIndex(size)])
+			HighFreqHeap::free(ptr, size);
+		else
+			HighFreqHeap::freeUncached(ptr, size);
+	}
+
+	inline void freeLowFreq(void * ptr) {
+		countLowFreq(0, 1, -static_cast<long>(_low_freq_heap.getSize(ptr)));
+		_low_freq_heap.free(ptr);
+	}
+
+	inline void countLowFreq(long allocs, long frees, long bytes) {
+		LowFreqCounts * local = &_local_low_freq;
+		local->allocs += allocs;
+		local->frees += frees;
+		local->bytes += bytes;
+		if (local->allocs + local->frees >= FOLD_COUNT)
+			foldLowFreq();
+	}
+
+	void foldLowFreq() {
+		LowFreqCounts * local = &_local_low_freq;
+		__sync_fetch_and_add(&_frequency_stats.low_freq_allocs, local->allocs);
+		__sync_fetch_and_add(&_frequency_stats.low_freq_frees, local->frees);
+		__sync_fetch_and_add(&_frequency_stats.low_freq_bytes, local->bytes);
+		local->allocs = 0;
+		local->frees = 0;
+		local->bytes = 0;
+	}
+
+	// add the counts of this thread to the shared ones, promote the size class if it has become popular and end the epoch if due
+	void fold(size_t index) {
+		LocalCounts * local = &_local_counts[index];
+		PopularityStats * stats = &_stats[index];
+		size_t allocs = local->allocs;
+
+		__sync_fetch_and_add(&stats->allocs, allocs);
+		__sync_fetch_and_add(&stats->live, local->live);
+		__sync_fetch_and_add(&_totals[index].allocs, allocs);
+		if (local->frees != 0)
+			__sync_fetch_and_add(&_totals[index].frees, local->frees);
+		local->allocs = 0;
+		local->live = 0;
+		local->frees = 0;
+
+		if (!_popular[index] && PopularityPolicy::promote(SizeClasses::indexToSize(index), *stats)) {
+			_popular[index] = true;
+			__sync_fetch_and_add(&_frequency_stats.promotions, 1);
+		}
+
+		// the count only grows, so exactly one thread crosses each multiple of the epoch length, even with a large batch
+		size_t epoch_allocs = __sync_add_and_fetch(&_epoch_allocs, allocs);
+		if (epoch_allocs / PopularityPolicy::EPOCH_LENGTH != (epoch_allocs - allocs) / PopularityPolicy::EPOCH_LENGTH)
+			endEpoch();
+
+		if (_demotions_seen != _frequency_stats.demotions)
+			flushDemoted();
+	}
+
+	// give back the objects this thread caches for size classes demoted since it last looked, as they would only be
+	// allocated again once their classes are promoted again and meanwhile keep their subheaps from being released
+	void flushDemoted() {
+		_demotions_seen = _frequency_stats.demotions;
+		for (size_t index = 0; index < SizeClasses::NUM_CLASSES; index++) {
+			if (!_popular[index])
+				HighFreqHeap::flushCache(index);
+		}
+	}
+
+	inline void loadProfileLine(const char * line) {
+		unsigned long size, allocs;
+		int popular;
+
+		if (sscanf(line, "%lu %d %lu", &size, &popular, &allocs) != 3 || size == 0 || size > SizeClasses::MAX_SIZE)
+			return;
+
+		size_t index = SizeClasses::sizeToIndex(size);
+		__sync_fetch_and_add(&_stats[index].allocs, allocs);
+		if (popular && !_popular[index]) {
+			_popular[index] = true;
+			__sync_fetch_and_add(&_frequency_stats.promotions, 1);
+		}
+	}
+
+	// decay the counts and demote the size classes that are no longer popular, their subheaps drain as objects are freed;
+	// the epochs are also the clock on which the spare subheaps of all size classes age, idle ones included
+	void endEpoch() {
+		for (size_t index = 0; index < SizeClasses::NUM_CLASSES; index++) {
+			PopularityStats * stats = &_stats[index];
+
+			size_t allocs;
+			do {
+				allocs = stats->allocs;
+			} while (!__sync_bool_compare_and_swap(&stats->allocs, allocs, PopularityPolicy::decay(allocs)));
+
+			if (_popular[index] && PopularityPolicy::demote(SizeClasses::indexToSize(index), *stats)) {
+				dbprintf("FrequencyHeap: demoting size %u\n", SizeClasses::indexToSize(index));
+				_popular[index] = false;
+				__sync_fetch_and_add(&_frequency_stats.demotions, 1);
+			}
+
+			HighFreqHeap::releaseIdleSpare(index);
+		}
+	}
 
 };	// end of class FrequencyHeap
 
+template<class SizeClasses, class PopularityPolicy, class LowFreqHeap, class HighFreqHeap>
+__thread typename FrequencyHeap<SizeClasses, PopularityPolicy, LowFreqHeap, HighFreqHeap>::LocalCounts FrequencyHeap<SizeClasses, PopularityPolicy, LowFreqHeap, HighFreqHeap>::_local_counts[SizeClasses::NUM_CLASSES];
+
+template<class SizeClasses, class PopularityPolicy, class LowFreqHeap, class HighFreqHeap>
+__thread typename FrequencyHeap<SizeClasses, PopularityPolicy, LowFreqHeap, HighFreqHeap>::LowFreqCounts FrequencyHeap<SizeClasses, PopularityPolicy, LowFreqHeap, HighFreqHeap>::_local_low_freq;
+
+template<class SizeClasses, class PopularityPolicy, class LowFreqHeap, class HighFreqHeap>
+__thread size_t FrequencyHeap<SizeClasses, PopularityPolicy, LowFreqHeap, HighFreqHeap>::_demotions_seen;
+
 };	// end of namespace VAM
 
 #endif
@@ -0,0 +1,69 @@
+// -*- C++ -*-
+
+#ifndef _GROUPHEAP_H_
+#define _GROUPHEAP_H_
+
+#include "vamcommon.h"
+
+namespace VAM {
+
+// GroupHeap: a heap for the objects of one locality group, which get subheaps of their own from SmallHeap
+// so that they share pages; larger objects come from LargeHeap and are linked so that they can be freed with the group
+template<size_t MaxSmallSize, class SmallHeap, class LargeHeap>
+class GroupHeap : public SmallHeap {
+
+public:
+
+	GroupHeap() {
+		INIT_LIST_HEAD(&_large_objects);
+	}
+
+	// the subheaps are released when SmallHeap is destroyed
+	~GroupHeap() {
+		while (!list_empty(&_large_objects)) {
+			list_head * node = _large_objects.next;
+			list_del(node);
+			_large_heap.free(node);
+		}
+	}
+
+	inline void * malloc(size_t size) {
+		if (size <= MaxSmallSize)
+			return SmallHeap::malloc(size);
+
+		list_head * node = reinterpret_cast<list_head *>(_large_heap.malloc(size + sizeof(list_head)));
+		if (node == NULL)
+			return NULL;
+
+		list_add(node, &_large_objects);
+		return node + 1;
+	}
+
+	inline void free(void * ptr) {
+		if (SmallHeap::ptrToType(ptr) != LOW_FREQ_TYPE) {
+			SmallHeap::free(ptr);
+			return;
+		}
+
+		list_head * node = reinterpret_cast<list_head *>(ptr) - 1;
+		list_del(node);
+		_large_heap.free(node);
+	}
+
+	inline size_t getSize(void * ptr) {
+		if (SmallHeap::ptrToType(ptr) != LOW_FREQ_TYPE)
+			return SmallHeap::getSize(ptr);
+
+		return _large_heap.getSize(reinterpret_cast<list_head *>(ptr) - 1) - sizeof(list_head);
+	}
+
+private:
+
+	LargeHeap _large_heap;
+	list_head _large_objects;
+
+};	// end of class GroupHeap
+
+};	// end of namespace VAM
+
+#endif
@@ -0,0 +1,209 @@
+// -*- C++ -*-
+
+#ifndef _HEAPPROFILER_H_
+#define _HEAPPROFILER_H_
+
+#include <execinfo.h>
+#include <math.h>
+
+#include "vamcommon.h"
+
+namespace VAM {
+
+// HeapProfiler: samples about one allocation every so many bytes, at exponentially distributed intervals so that
+// an object of size s is sampled with probability 1 - exp(-s / rate), and keeps the backtraces of the sampled objects
+// until they are freed; the side table is fixed in size and never allocates, a sample that finds its bucket full is dropped;
+// the live samples can be written out as a heap profile in the legacy format of gperftools, which pprof reads
+template<int MaxDepth>
+class HeapProfiler {
+
+public:
+
+	HeapProfiler() : _rate(0), _num_live(0), _num_dropped(0) {
+		memset(_slots, 0, sizeof(_slots));
+	}
+
+	// 0 stops sampling, threads notice a new rate within DISABLED_INTERVAL bytes of allocations
+	void setRate(size_t rate) {
+		// the first backtrace() loads the unwinder, which allocates, so do it here rather than in the middle of malloc()
+		if (rate != 0) {
+			void * stack[1];
+			backtrace(stack, 1);
+		}
+		_rate = rate;
+	}
+
+	// count an allocation of size bytes, the fast path is a subtraction in the thread's countdown
+	inline void countBytes(void * ptr, size_t size) {
+		_bytes_until_sample -= size;
+		if (_bytes_until_sample < 0)
+			sample(ptr, size);
+	}
+
+	// forget a sampled object that is being freed, which costs a look at one bucket once there are samples
+	inline void forget(void * ptr) {
+		if (_num_live == 0)
+			return;
+
+		void ** bucket = &_slots[hashPtr(ptr) * BUCKET_SIZE];
+		for (int i = 0; i < BUCKET_SIZE; i++) {
+			if (bucket[i] == ptr) {
+				bucket[i] = NULL;
+				__sync_fetch_and_sub(&_num_live, 1);
+				return;
+			}
+		}
+	}
+
+	inline size_t getNumDropped() {
+		return _num_dropped;
+	}
+
+	// write the live samples as a heap profile, without allocating, so that it can be done from a signal handler;
+	// samples taken or freed while writing may or may not show
+	bool dump(int fd) {
+		size_t num_objects = 0;
+		size_t num_bytes = 0;
+		for (size_t i = 0; i < NUM_SAMPLES; i++) {
+			if (isSampled(_slots[i])) {
+				num_objects++;
+				num_bytes += _samples[i].size;
+			}
+		}
+
+		char line[LINE_SIZE];
+		int n = snprintf(line, sizeof(line), "heap profile: %6lu: %8lu [%6lu: %8lu] @ heap_v2/%lu\n",
+			(unsigned long) num_objects, (unsigned long) num_bytes, (unsigned long) num_objects, (unsigned long) num_bytes, (unsigned long) _rate);
+		bool ok = write(fd, line, n) == n;
+
+		// one line per sample, pprof adds up those with the same stack
+		for (size_t i = 0; i < NUM_SAMPLES && ok; i++) {
+			if (!isSampled(_slots[i]))
+				continue;
+
+			Sample * s = &_samples[i];
+			n = snprintf(line, sizeof(line), "%6d: %8lu [%6d: %8lu] @", 1, (unsigned long) s->size, 1, (unsigned long) s->size);
+			for (int d = 0; d < s->depth && d < MaxDepth; d++)
+				n += snprintf(line + n, sizeof(line) - n, " %p", s->stack[d]);
+			line[n++] = '\n';
+			ok = write(fd, line, n) == n;
+		}
+
+		// pprof needs the mappings to find the symbols
+		n = snprintf(line, sizeof(line), "\nMAPPED_LIBRARIES:\n");
+		ok = ok && write(fd, line, n) == n;
+
+		int maps = open("/proc/self/maps", O_RDONLY);
+		if (maps < 0)
+			return false;
+		while (ok && (n = read(maps, line, sizeof(line))) > 0)
+			ok = write(fd, line, n) == n;
+		close(maps);
+
+		return ok && n == 0;
+	}
+
+private:
+
+	enum {
+		NUM_BUCKETS = 2048,
+		BUCKET_SIZE = 4,		// a bucket of pointers is half a cache line
+		NUM_SAMPLES = NUM_BUCKETS * BUCKET_SIZE,
+		SKIPPED_FRAMES = 1,		// sample() itself
+		DISABLED_INTERVAL = 64 * 1024 * 1024,
+		LINE_SIZE = 64 + MaxDepth * 20,
+		CLAIMED = 1,
+	};
+
+	struct Sample {
+		size_t size;
+		int depth;
+		void * stack[MaxDepth];
+	};
+
+	size_t _rate;
+	size_t _num_live;
+	size_t _num_dropped;
+
+	// the sampled objects, kept apart from their samples so that a free looks at one short bucket
+	void * _slots[NUM_SAMPLES];
+	Sample _samples[NUM_SAMPLES];
+
+	static __thread long _bytes_until_sample;
+	static __thread size_t _random;
+	static __thread bool _busy;
+
+	inline static size_t hashPtr(void * ptr) {
+		size_t h = reinterpret_cast<size_t>(ptr) >> 4;
+		return (h ^ (h >> 11)) % NUM_BUCKETS;
+	}
+
+	inline static bool isSampled(void * slot) {
+		return reinterpret_cast<size_t>(slot) > CLAIMED;
+	}
+
+	// an exponentially distributed number of bytes to the next sample, from a xorshift generator of the thread
+	inline long nextInterval(size_t rate) {
+		_random ^= _random << 13;
+		_random ^= _random >> 7;
+		_random ^= _random << 17;
+		double u = ((_random >> 11) + 1) / 9007199254740993.0;
+		return static_cast<long>(-log(u) * rate) + 1;
+	}
+
+	__attribute__((noinline)) void sample(void * ptr, size_t size) {
+		size_t rate = _rate;
+		if (rate == 0) {
+			_bytes_until_sample = DISABLED_INTERVAL;
+			return;
+		}
+
+		// the first countdown of a thread only starts it, otherwise every thread would sample its first allocation
+		bool first = _random == 0;
+		if (first)
+			_random = reinterpret_cast<size_t>(&_random) * 2654435761UL | 1;
+		_bytes_until_sample = nextInterval(rate);
+		if (first || _busy)
+			return;
+
+		_busy = true;
+		void ** bucket = &_slots[hashPtr(ptr) * BUCKET_SIZE];
+		int i;
+		for (i = 0; i < BUCKET_SIZE; i++) {
+			if (bucket[i] == NULL && __sync_bool_compare_and_swap(&bucket[i], NULL, reinterpret_cast<void *>(CLAIMED)))
+				break;
+		}
+
+		if (i < BUCKET_SIZE) {
+			Sample * s = &_samples[&bucket[i] - _slots];
+			void * stack[MaxDepth + SKIPPED_FRAMES];
+			int depth = backtrace(stack, MaxDepth + SKIPPED_FRAMES) - SKIPPED_FRAMES;
+			s->size = size;
+			s->depth = depth > 0 ? depth : 0;
+			memcpy(s->stack, stack + SKIPPED_FRAMES, s->depth * sizeof(void *));
+
+			// publish the object only once its sample is complete
+			__sync_synchronize();
+			bucket[i] = ptr;
+			__sync_fetch_and_add(&_num_live, 1);
+		}
+		else {
+			__sync_fetch_and_add(&_num_dropped, 1);
+		}
+		_busy = false;
+	}
+
+};	// end of class HeapProfiler
+
+template<int MaxDepth>
+__thread long HeapProfiler<MaxDepth>::_bytes_until_sample;
+
+template<int MaxDepth>
+__thread size_t HeapProfiler<MaxDepth>::_random;
+
+template<int MaxDepth>
+__thread bool HeapProfiler<MaxDepth>::_busy;
+
+};	// end of namespace VAM
+
+#endif
@@ -0,0 +1,177 @@
+// -*- C++ -*-
+
+#ifndef _LATENCYHISTOGRAM_H_
+#define _LATENCYHISTOGRAM_H_
+
+#include <string.h>
+#include <time.h>
+
+#include "vamcommon.h"
+
+namespace VAM {
+
+// the slow paths that are timed when built with -DLATENCY_HISTOGRAMS
+enum {
+	LATENCY_SUBHEAP_CREATE,		// PartitionHeap creating a partition subheap, which includes the two below
+	LATENCY_HUGE_CREATE,		// PartitionHeap creating the subheap of a huge object
+	LATENCY_CLUSTER_INIT,		// the PageClusterHeap constructor
+	LATENCY_MMAP,				// AlignedMmapHeap mapping and trimming an aligned region
+	LATENCY_MUNMAP,				// AlignedMmapHeap unmapping a region
+	LATENCY_LARGE_SCAN,			// SegFitHeap scanning its list of large free blocks
+	NUM_LATENCY_EVENTS,
+};
+
+// a cheap, monotonic count of cycles, or of nanoseconds where there is no cycle counter we know of
+inline static unsigned long long readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	unsigned long long cycles;
+	asm volatile("mrs %0, cntvct_el0" : "=r" (cycles));
+	return cycles;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// LatencyHistogram: a log-linear histogram of cycle counts, SUB_BUCKETS linear buckets per power of two as in HDR histograms,
+// which keeps the error of any percentile under 1/SUB_BUCKETS; all zero when static, so it needs no constructor
+class LatencyHistogram {
+
+public:
+
+	inline void record(unsigned long long cycles) {
+		__sync_fetch_and_add(&_buckets[cyclesToBucket(cycles)], 1);
+		__sync_fetch_and_add(&_count, 1);
+		__sync_fetch_and_add(&_total, cycles);
+
+		unsigned long long max;
+		while ((max = _max) < cycles && !__sync_bool_compare_and_swap(&_max, max, cycles));
+	}
+
+	void reset() {
+		memset(this, 0, sizeof(*this));
+	}
+
+	// the lowest count of cycles of the bucket in which the given fraction of the events is reached
+	unsigned long long getPercentile(double fraction) {
+		unsigned long long target = static_cast<unsigned long long>(_count * fraction);
+		unsigned long long seen = 0;
+		for (int i = 0; i < NUM_BUCKETS; i++) {
+			seen += _buckets[i];
+			if (seen > target)
+				return bucketToCycles(i);
+		}
+		return _max;
+	}
+
+	// a summary line, followed by a "low count" line for each bucket in use
+	bool dump(int fd, const char * name) {
+		char line[LINE_SIZE];
+		int n = snprintf(line, sizeof(line), "%-16s count %llu mean %llu p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu\n",
+			name, _count, _count > 0 ? _total / _count : 0,
+			getPercentile(0.5), getPercentile(0.9), getPercentile(0.99), getPercentile(0.999), _max);
+		bool ok = write(fd, line, n) == n;
+
+		for (int i = 0; i < NUM_BUCKETS && ok; i++) {
+			if (_buckets[i] == 0)
+				continue;
+			n = snprintf(line, sizeof(line), "\t%llu %llu\n", bucketToCycles(i), _buckets[i]);
+			ok = write(fd, line, n) == n;
+		}
+
+		return ok;
+	}
+
+private:
+
+	enum {
+		SUB_BITS = 4,
+		SUB_BUCKETS = 1 << SUB_BITS,
+		NUM_BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS,
+		LINE_SIZE = 160,
+	};
+
+	unsigned long long _buckets[NUM_BUCKETS];
+	unsigned long long _count;
+	unsigned long long _total;
+	unsigned long long _max;
+
+	// values below SUB_BUCKETS get a bucket each, then each power of two is split in SUB_BUCKETS equal parts
+	inline static int cyclesToBucket(unsigned long long cycles) {
+		if (cycles < SUB_BUCKETS)
+			return cycles;
+		int e = 63 - __builtin_clzll(cycles);
+		return (e - SUB_BITS + 1) * SUB_BUCKETS + (cycles >> (e - SUB_BITS)) - SUB_BUCKETS;
+	}
+
+	inline static unsigned long long bucketToCycles(int bucket) {
+		if (bucket < SUB_BUCKETS)
+			return bucket;
+		int e = bucket / SUB_BUCKETS + SUB_BITS - 1;
+		return (static_cast<unsigned long long>(bucket % SUB_BUCKETS + SUB_BUCKETS)) << (e - SUB_BITS);
+	}
+
+};	// end of class LatencyHistogram
+
+// the histograms of all slow paths, shared by all heaps
+inline LatencyHistogram * getLatencyHistogram(int event) {
+	static LatencyHistogram histograms[NUM_LATENCY_EVENTS];
+	return &histograms[event];
+}
+
+// LatencyTimer: times its own scope into the histogram of an event, and compiles to nothing without LATENCY_HISTOGRAMS
+class LatencyTimer {
+
+public:
+
+#ifdef LATENCY_HISTOGRAMS
+	inline LatencyTimer(int event) : _event(event), _start(readCycles()) {}
+
+	inline ~LatencyTimer() {
+		getLatencyHistogram(_event)->record(readCycles() - _start);
+	}
+
+private:
+
+	int _event;
+	unsigned long long _start;
+#else
+	inline LatencyTimer(int) {}
+#endif
+
+};	// end of class LatencyTimer
+
+// write the histograms of all slow paths, with the rate of the cycle counter measured over a few milliseconds to read them by
+inline static bool dumpLatencyHistograms(int fd) {
+	static const char * names[NUM_LATENCY_EVENTS] = {
+		"subheap_create", "huge_create", "cluster_init", "mmap", "munmap", "large_scan",
+	};
+
+	struct timespec start_time, end_time, pause = { 0, 10000000 };
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	unsigned long long start = readCycles();
+	nanosleep(&pause, NULL);
+	unsigned long long cycles = readCycles() - start;
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	double ns = (end_time.tv_sec - start_time.tv_sec) * 1e9 + (end_time.tv_nsec - start_time.tv_nsec);
+
+	char line[64];
+	int n = snprintf(line, sizeof(line), "# cycles per microsecond %.1f\n", cycles * 1000.0 / ns);
+	bool ok = write(fd, line, n) == n;
+
+	for (int event = 0; event < NUM_LATENCY_EVENTS && ok; event++)
+		ok = getLatencyHistogram(event)->dump(fd, names[event]);
+	return ok;
+}
+
+inline static void resetLatencyHistograms() {
+	for (int event = 0; event < NUM_LATENCY_EVENTS; event++)
+		getLatencyHistogram(event)->reset();
+}
+
+};	// end of namespace VAM
+
+#endif
@@ -0,0 +1,242 @@
+// -*- C++ -*-
+
+#ifndef _LAYOUTDUMPER_H_
+#define _LAYOUTDUMPER_H_
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include "vamcommon.h"
+#include "libvam.h"
+#include "objectheader.h"
+
+namespace VAM {
+
+// LayoutDumper: a visitor of the partitions and page clusters of PartitionHeap that writes the layout of the heap,
+// in the records of libvam.h, with residency from mincore(); a page cluster in use in a partition of type LOW_FREQ_TYPE
+// is a low frequency chunk, in one of a type above RegionTypeOffset a chunk of a region, elsewhere a subheap whose reap
+// SubHeapSource keeps; it never allocates and checks what it reads, as other threads may be changing the heap under it,
+// though PartitionHeap does not release the partitions while they are visited
+template<class SubHeap, class SubHeapSource, size_t PartitionSize, unsigned char RegionTypeOffset>
+class LayoutDumper {
+
+public:
+
+	LayoutDumper(int fd) : _fd(fd), _num_buffered(0), _ok(true) {
+		struct vam_layout_header header;
+		memset(&header, 0, sizeof(header));
+		header.magic = VAM_LAYOUT_MAGIC;
+		header.version = VAM_LAYOUT_VERSION;
+		header.page_size = PAGE_SIZE;
+		header.record_size = sizeof(struct vam_layout_record);
+		header.partition_size = PartitionSize;
+		_ok = write(_fd, &header, sizeof(header)) == sizeof(header);
+	}
+
+	bool finish() {
+		flush();
+		return _ok;
+	}
+
+	template<class PartitionSubHeap>
+	void visitPartition(unsigned char type, PartitionSubHeap * heap) {
+		size_t start = reinterpret_cast<size_t>(heap->getHeapAddress());
+		size_t size = heap->getHeapSize();
+
+		// huge objects are walked in pieces of a partition
+		if (size > PartitionSize) {
+			struct vam_layout_record * record = newRecord(VAM_LAYOUT_HUGE, type, start, size);
+			for (size_t offset = 0; offset < size; offset += PartitionSize) {
+				size_t piece = size - offset < PartitionSize ? size - offset : PartitionSize;
+				loadResidency(start + offset, piece);
+				record->resident += countResident(start + offset, piece);
+			}
+			return;
+		}
+
+		loadResidency(start, size);
+		_type = type;
+		_num_clusters = 0;
+		_num_free = 0;
+		_num_discarded = 0;
+		_free_resident = 0;
+		heap->visitClusters(*this);
+
+		struct vam_layout_record * record = newRecord(VAM_LAYOUT_PARTITION, type, start, size);
+		record->resident = countResident(start, size);
+		record->a = _num_clusters;
+		record->b = _num_free;
+		record->c = _num_discarded;
+		record->d = _free_resident;
+	}
+
+	void visitCluster(void * ptr, size_t size, bool is_free, bool is_discarded) {
+		size_t start = reinterpret_cast<size_t>(ptr);
+		size_t resident = countResident(start, size);
+
+		_num_clusters++;
+		if (is_free) {
+			_num_free++;
+			_num_discarded += is_discarded;
+			_free_resident += resident;
+		}
+		else if (_type == LOW_FREQ_TYPE)
+			dumpChunk(start, size, resident);
+		else if (_type > RegionTypeOffset)
+			newRecord(VAM_LAYOUT_REGION, _type, start, size)->resident = resident;
+		else
+			dumpSubHeap(start, size, resident);
+	}
+
+private:
+
+	enum {
+		BUFFER_RECORDS = 64,
+		NUM_BLOCK_ORDERS = 64,
+		PAGES_PER_PARTITION = PartitionSize / PAGE_SIZE,
+	};
+
+	int _fd;
+	size_t _num_buffered;
+	bool _ok;
+	struct vam_layout_record _buffer[BUFFER_RECORDS];
+
+	// residency of the partition being walked
+	size_t _residency_start;
+	unsigned char _residency[PAGES_PER_PARTITION];
+
+	// counts of the partition being walked
+	unsigned char _type;
+	size_t _num_clusters;
+	size_t _num_free;
+	size_t _num_discarded;
+	size_t _free_resident;
+
+	SubHeapSource _source;
+
+	void flush() {
+		size_t n = _num_buffered * sizeof(struct vam_layout_record);
+		if (n > 0 && _ok)
+			_ok = write(_fd, _buffer, n) == static_cast<ssize_t>(n);
+		_num_buffered = 0;
+	}
+
+	inline struct vam_layout_record * newRecord(unsigned char kind, unsigned char type, size_t address, size_t size) {
+		if (_num_buffered == BUFFER_RECORDS)
+			flush();
+
+		struct vam_layout_record * record = &_buffer[_num_buffered++];
+		memset(record, 0, sizeof(*record));
+		record->kind = kind;
+		record->type = type;
+		record->address = address;
+		record->size = size;
+		return record;
+	}
+
+	// at most a partition, pages mincore() cannot tell about count as not resident
+	void loadResidency(size_t start, size_t size) {
+		_residency_start = start;
+		if (mincore(reinterpret_cast<void *>(start), size, _residency) != 0)
+			memset(_residency, 0, sizeof(_residency));
+	}
+
+	// the resident pages that lie entirely between start and end, within the partition loaded last
+	inline size_t countResident(size_t start, size_t size) {
+		size_t first = (start - _residency_start + PAGE_SIZE - 1) / PAGE_SIZE;
+		size_t last = (start + size - _residency_start) / PAGE_SIZE;
+		size_t resident = 0;
+		for (size_t page = first; page < last && page < PAGES_PER_PARTITION; page++)
+			resident += _residency[page] & 1;
+		return resident;
+	}
+
+	// a reap is only trusted if the objects it describes fit in its page cluster, and a partition that
+	// SubHeapSource never handed out has no side table for its metadata
+	void dumpSubHeap(size_t start, size_t size, size_t resident) {
+		SubHeap * subheap = reinterpret_cast<SubHeap *>(_source.getMetadata(reinterpret_cast<void *>(start)));
+		if (reinterpret_cast<size_t>(subheap) < PartitionSize) {
+			newRecord(VAM_LAYOUT_UNKNOWN, _type, start, size)->resident = resident;
+			return;
+		}
+
+		size_t base = reinterpret_cast<size_t>(subheap->getBasePtr());
+		size_t object_size = subheap->getObjectSize();
+		size_t num_total = subheap->getNumTotal();
+		size_t num_free = subheap->getNumFree();
+
+		if (object_size < sizeof(double) || base < start || base >= start + size || num_total == 0
+			|| num_total > (start + size - base) / object_size || num_free > num_total) {
+			newRecord(VAM_LAYOUT_UNKNOWN, _type, start, size)->resident = resident;
+			return;
+		}
+
+		struct vam_layout_record * record = newRecord(VAM_LAYOUT_SUBHEAP, _type, start, size);
+		record->order = __builtin_ctzl(size / PAGE_SIZE);
+		record->resident = resident;
+		record->a = object_size;
+		record->b = num_total;
+		record->c = num_free;
+	}
+
+	// walk the objects of a low frequency chunk, which lie between an empty header at the start and two at the end,
+	// see SplitCoalesceHeap; the walk stops at anything that leads out of the chunk
+	void dumpChunk(size_t start, size_t size, size_t resident) {
+		size_t end = start + size;
+		size_t used = 0;
+		size_t free = 0;
+		size_t largest = 0;
+		size_t free_resident = 0;
+		size_t counts[NUM_BLOCK_ORDERS];
+		size_t bytes[NUM_BLOCK_ORDERS];
+		memset(counts, 0, sizeof(counts));
+		memset(bytes, 0, sizeof(bytes));
+
+		ObjectHeader * header = reinterpret_cast<ObjectHeader *>(start) + 1;
+		while (header->_size != 0 && header->_size < size) {
+			ObjectHeader * next = header->getNextHeader();
+			if (reinterpret_cast<size_t>(next + 1) > end)
+				break;
+
+			size_t block = header->_size;
+			if (next->_prev_free) {
+				int order = SIZE_T_BIT - __builtin_clzl(block);
+				counts[order]++;
+				bytes[order] += block;
+				free += block;
+				if (block > largest)
+					largest = block;
+
+				// the free list node at the start of a free block stays
+				size_t object = reinterpret_cast<size_t>(header->getObject()) + sizeof(list_head);
+				if (block > sizeof(list_head))
+					free_resident += countResident(object, block - sizeof(list_head));
+			}
+			else
+				used += block;
+
+			header = next;
+		}
+
+		struct vam_layout_record * record = newRecord(VAM_LAYOUT_CHUNK, _type, start, size);
+		record->resident = resident;
+		record->a = used;
+		record->b = free;
+		record->c = largest;
+		record->d = free_resident;
+
+		for (int order = 0; order < NUM_BLOCK_ORDERS; order++) {
+			if (counts[order] == 0)
+				continue;
+			record = newRecord(VAM_LAYOUT_FREE_BLOCKS, _type, start, size);
+			record->order = order;
+			record->a = counts[order];
+			record->b = bytes[order];
+		}
+	}
+
+};	// end of class LayoutDumper
+
+};	// end of namespace VAM
+
+#endif
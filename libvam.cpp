@@ -1,9 +1,30 @@
 // -*- C++ -*-
 
+#include <errno.h>
 #include <new>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include "libvam.h"
 #include "vam.h"
 
-class TheCustomHeapType : public CustomAllocator {};
+// lifetime segregation tells allocation sites apart by the caller of the entry point, see LifetimeHeap
+#ifdef LIFETIME_SEGREGATION
+#define NOTE_CALLER()	HighFreqHeap::setCaller(__builtin_return_address(0))
+#else
+#define NOTE_CALLER()
+#endif
+
+class TheCustomHeapType : public CustomAllocator {
+#ifdef LIFETIME_SEGREGATION
+public:
+	// always inlined into the malloc() of the wrapper, so the return address is that of its caller
+	__attribute__((always_inline)) inline void * malloc(size_t size) {
+		NOTE_CALLER();
+		return CustomAllocator::malloc(size);
+	}
+#endif
+};
 
 inline static TheCustomHeapType * getCustomHeap() {
 	static char thBuf[sizeof(TheCustomHeapType)];
@@ -15,4 +36,458 @@ inline static TheCustomHeapType * getCustomHeap() {
 #pragma warning(disable:4273)
 #endif
 
+// the wrapper's calloc() always clears, its realloc() always allocates, copies and frees, and its aligned
+// allocations pad a malloc() of their own, so they are renamed out of the way, and those at the end of this file
+// take the known-zero, in-place and naturally aligned paths of VamHeap instead; memory tracing keeps the wrapper's
+// calloc(), whose malloc() goes through DenyDlsymHeap
+#ifndef MEMORY_TRACE
+#define calloc	wrapper_calloc
+#endif
+#define realloc	wrapper_realloc
+#define memalign	wrapper_memalign
+#define posix_memalign	wrapper_posix_memalign
+#define aligned_alloc	wrapper_aligned_alloc
+#define valloc	wrapper_valloc
+#define pvalloc	wrapper_pvalloc
 #include "wrapper.cpp"
+#undef calloc
+#undef realloc
+#undef memalign
+#undef posix_memalign
+#undef aligned_alloc
+#undef valloc
+#undef pvalloc
+
+// Vam-specific extensions, see libvam.h
+
+// the same size normalization the wrapper applies to malloc()
+inline static size_t normalizeSize(size_t size) {
+	if (size < 2 * sizeof(size_t))
+		size = 2 * sizeof(size_t);
+	return (size + sizeof(double) - 1) & ~(sizeof(double) - 1);
+}
+
+extern "C" size_t vam_malloc_batch(size_t size, size_t n, void ** ptrs) {
+	NOTE_CALLER();
+	return getCustomHeap()->mallocBatch(normalizeSize(size), ptrs, n);
+}
+
+extern "C" void vam_free_batch(void ** ptrs, size_t n) {
+	getCustomHeap()->freeBatch(ptrs, n);
+}
+
+extern "C" void vam_free_sized(void * ptr, size_t size) {
+	if (ptr != NULL)
+		getCustomHeap()->VamHeap::free(ptr, normalizeSize(size));
+}
+
+extern "C" size_t vam_nallocx(size_t size) {
+	return getCustomHeap()->getRoundedSize(normalizeSize(size));
+}
+
+// shared by vam_calloc() and calloc(), which note their own callers
+inline static void * callocObject(size_t n, size_t size) {
+	if (size != 0 && n > (size_t) -1 / size)
+		return NULL;
+	return getCustomHeap()->VamHeap::calloc(normalizeSize(n * size));
+}
+
+extern "C" void * vam_calloc(size_t n, size_t size) {
+	NOTE_CALLER();
+	return callocObject(n, size);
+}
+
+// shared by vam_realloc() and realloc(), which note their own callers
+inline static void * reallocObject(void * ptr, size_t size) {
+	if (ptr != NULL && size == 0) {
+		getCustomHeap()->free(ptr);
+		return NULL;
+	}
+	return getCustomHeap()->VamHeap::realloc(ptr, normalizeSize(size));
+}
+
+extern "C" void * vam_realloc(void * ptr, size_t size) {
+	NOTE_CALLER();
+	return reallocObject(ptr, size);
+}
+
+// shared by vam_memalign() and the standard aligned allocations, which note their own callers
+inline static void * memalignObject(size_t alignment, size_t size) {
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	// VamHeap rounds the size up to the alignment
+	if (size > (size_t) -1 - alignment) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	void * ptr = getCustomHeap()->VamHeap::memalign(alignment, normalizeSize(size));
+	if (ptr == NULL)
+		errno = ENOMEM;
+	return ptr;
+}
+
+extern "C" void * vam_memalign(size_t alignment, size_t size) {
+	NOTE_CALLER();
+	return memalignObject(alignment, size);
+}
+
+extern "C" int vam_profile_save(const char * path) {
+	return getCustomHeap()->saveProfile(path) ? 0 : -1;
+}
+
+extern "C" int vam_profile_load(const char * path) {
+	return getCustomHeap()->loadProfile(path) ? 0 : -1;
+}
+
+// the main heap, which serves the large objects of locality groups
+class TheVamHeap {
+public:
+	inline void * malloc(size_t size) {
+		return getCustomHeap()->VamHeap::malloc(size);
+	}
+
+	inline void free(void * ptr) {
+		getCustomHeap()->VamHeap::free(ptr);
+	}
+
+	inline size_t getSize(void * ptr) {
+		return getCustomHeap()->VamHeap::getSize(ptr);
+	}
+};
+
+struct vam_heap : public VamGroupHeap<TheVamHeap> {};
+
+extern "C" vam_heap_t * vam_heap_create(void) {
+	void * space = getCustomHeap()->VamHeap::malloc(sizeof(vam_heap));
+	if (space == NULL)
+		return NULL;
+	return new (space) vam_heap;
+}
+
+extern "C" void * vam_heap_malloc(vam_heap_t * heap, size_t size) {
+	return heap->malloc(normalizeSize(size));
+}
+
+extern "C" void vam_heap_free(vam_heap_t * heap, void * ptr) {
+	if (ptr != NULL)
+		heap->free(ptr);
+}
+
+extern "C" void vam_heap_destroy(vam_heap_t * heap) {
+	heap->~vam_heap();
+	getCustomHeap()->VamHeap::free(heap);
+}
+
+struct vam_region : public VamRegionHeap {};
+
+extern "C" vam_region_t * vam_region_create(void) {
+	void * space = getCustomHeap()->VamHeap::malloc(sizeof(vam_region));
+	if (space == NULL)
+		return NULL;
+	return new (space) vam_region;
+}
+
+extern "C" void * vam_region_alloc(vam_region_t * region, size_t size) {
+	return region->malloc(normalizeSize(size));
+}
+
+extern "C" void vam_region_free(vam_region_t * region, void * ptr) {
+	if (ptr != NULL)
+		region->free(ptr);
+}
+
+extern "C" void vam_region_destroy(vam_region_t * region) {
+	region->~vam_region();
+	getCustomHeap()->VamHeap::free(region);
+}
+
+extern "C" int vam_stats_get(struct vam_stats * stats) {
+	TheCustomHeapType * heap = getCustomHeap();
+	heap->foldLocalCounts();
+	memset(stats, 0, sizeof(*stats));
+
+	stats->num_classes = SizeClasses::NUM_CLASSES < VAM_STATS_MAX_CLASSES ? SizeClasses::NUM_CLASSES : VAM_STATS_MAX_CLASSES;
+	for (size_t index = 0; index < stats->num_classes; index++) {
+		struct vam_class_stats * class_stats = &stats->classes[index];
+		const PopularityStats & popularity = heap->getPopularityStats(index);
+		const ClassTotals & totals = heap->getClassTotals(index);
+		ChurnStats churn = heap->getChurnStats(index);
+
+		class_stats->size = SizeClasses::indexToSize(index);
+		class_stats->popular = heap->isPopular(index);
+		class_stats->allocs = totals.allocs;
+		class_stats->frees = totals.frees;
+		class_stats->live = popularity.live > 0 ? popularity.live : 0;
+		class_stats->live_bytes = class_stats->live * class_stats->size;
+		class_stats->subheaps_created = churn.created;
+		class_stats->subheaps_released = churn.released;
+		class_stats->subheaps_reused = churn.reused;
+	}
+
+	size_t partitions[NUM_PARTITION_TYPES];
+	size_t clusters[NUM_PARTITION_TYPES];
+	size_t resident[NUM_PARTITION_TYPES];
+	PageSourceHeap page_source;
+	page_source.getStats(partitions, clusters, &stats->discarded_clusters);
+	page_source.getResidentPages(resident);
+	page_source.getPurgeCounts(&stats->purged_clusters, &stats->released_partitions);
+
+	stats->num_types = NUM_PARTITION_TYPES < VAM_STATS_MAX_TYPES ? NUM_PARTITION_TYPES : VAM_STATS_MAX_TYPES;
+	for (size_t type = 0; type < stats->num_types; type++) {
+		stats->partitions[type] = partitions[type];
+		stats->clusters[type] = clusters[type];
+		stats->resident_pages[type] = resident[type];
+	}
+
+	const FrequencyStats & frequency = heap->getFrequencyStats();
+	stats->low_freq_allocs = frequency.low_freq_allocs;
+	stats->low_freq_frees = frequency.low_freq_frees;
+	stats->low_freq_live_bytes = frequency.low_freq_bytes > 0 ? frequency.low_freq_bytes : 0;
+	stats->promotions = frequency.promotions;
+	stats->demotions = frequency.demotions;
+
+	return 0;
+}
+
+// warm start from the profile named by VAM_PROFILE, and update it at exit
+static class ProfileKeeper {
+public:
+	ProfileKeeper() {
+		const char * path = getenv("VAM_PROFILE");
+		if (path != NULL)
+			vam_profile_load(path);
+	}
+
+	~ProfileKeeper() {
+		const char * path = getenv("VAM_PROFILE");
+		if (path != NULL)
+			vam_profile_save(path);
+	}
+} profileKeeper;
+
+extern "C" void vam_sample_rate(size_t rate) {
+	getCustomHeap()->setSampleRate(rate);
+}
+
+extern "C" int vam_sample_dump(const char * path) {
+	return getCustomHeap()->dumpSamples(path) ? 0 : -1;
+}
+
+extern "C" int vam_latency_dump(const char * path) {
+	int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return -1;
+
+	bool ok = dumpLatencyHistograms(fd);
+	close(fd);
+	return ok ? 0 : -1;
+}
+
+extern "C" void vam_latency_reset(void) {
+	resetLatencyHistograms();
+}
+
+extern "C" int vam_layout_dump(const char * path) {
+	int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return -1;
+
+	LayoutDumper<WORKHORSE_HEAP, SubHeapSourceHeap, PARTITION_SIZE, REGION_TYPE_OFFSET> dumper(fd);
+	PageSourceHeap().visitPartitions(dumper);
+	bool ok = dumper.finish();
+	close(fd);
+	return ok ? 0 : -1;
+}
+
+// install a handler for the signal whose number the environment variable holds, if any
+static void handleSignal(const char * name, void (* handler)(int)) {
+	const char * signum = getenv(name);
+	if (signum == NULL || atoi(signum) <= 0)
+		return;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(atoi(signum), &action, NULL);
+}
+
+// start the heap profiler at the rate set by VAM_SAMPLE_RATE, and dump it on the signal set by VAM_SAMPLE_SIGNAL
+static class SampleKeeper {
+public:
+	SampleKeeper() {
+		const char * rate = getenv("VAM_SAMPLE_RATE");
+		if (rate != NULL && atol(rate) > 0)
+			vam_sample_rate(atol(rate));
+
+		handleSignal("VAM_SAMPLE_SIGNAL", dump);
+	}
+
+private:
+	static void dump(int) {
+		static int count = 0;
+		char path[64];
+		snprintf(path, sizeof(path), "vam.%d.%d.heap", (int) getpid(), count++);
+		vam_sample_dump(path);
+	}
+} sampleKeeper;
+
+// dump the heap layout on the signal set by VAM_LAYOUT_SIGNAL
+static class LayoutKeeper {
+public:
+	LayoutKeeper() {
+		handleSignal("VAM_LAYOUT_SIGNAL", dump);
+	}
+
+private:
+	static void dump(int) {
+		static int count = 0;
+		char path[64];
+		snprintf(path, sizeof(path), "vam.%d.%d.layout", (int) getpid(), count++);
+		vam_layout_dump(path);
+	}
+} layoutKeeper;
+
+// publish the statistics into /dev/shm/vam.<pid> every VAM_STATS_INTERVAL milliseconds, for tools/vamstat;
+// the snapshots are taken by a thread of our own, so the allocation paths never pay for them
+static class StatsPublisher {
+public:
+	StatsPublisher() : _segment(NULL) {
+		const char * interval = getenv("VAM_STATS_INTERVAL");
+		if (interval == NULL || atoi(interval) <= 0)
+			return;
+
+		snprintf(_path, sizeof(_path), "/dev/shm/vam.%d", (int) getpid());
+		int fd = open(_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			return;
+
+		void * space = MAP_FAILED;
+		if (ftruncate(fd, sizeof(struct vam_stats_segment)) == 0)
+			space = mmap(NULL, sizeof(struct vam_stats_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (space == MAP_FAILED) {
+			unlink(_path);
+			return;
+		}
+
+		_segment = reinterpret_cast<struct vam_stats_segment *>(space);
+		_segment->magic = VAM_STATS_MAGIC;
+		_segment->version = VAM_STATS_VERSION;
+		_segment->interval = atoi(interval);
+		_segment->page_size = PAGE_SIZE;
+
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, publish, _segment) != 0) {
+			shutdown();
+			return;
+		}
+		pthread_detach(thread);
+	}
+
+	~StatsPublisher() {
+		shutdown();
+	}
+
+private:
+	struct vam_stats_segment * _segment;
+	char _path[32];
+
+	// the segment stays mapped, the thread may still be writing to it
+	void shutdown() {
+		if (_segment != NULL) {
+			unlink(_path);
+			_segment = NULL;
+		}
+	}
+
+	// a seqlock with a single writer: readers retry while the sequence is odd or has moved during their copy
+	static void * publish(void * arg) {
+		struct vam_stats_segment * segment = reinterpret_cast<struct vam_stats_segment *>(arg);
+		struct timespec interval;
+		interval.tv_sec = segment->interval / 1000;
+		interval.tv_nsec = segment->interval % 1000 * 1000000L;
+
+		while (true) {
+			segment->sequence++;
+			__sync_synchronize();
+			vam_stats_get(&segment->stats);
+			segment->snapshots++;
+			__sync_synchronize();
+			segment->sequence++;
+
+			nanosleep(&interval, NULL);
+		}
+		return NULL;
+	}
+} statsPublisher;
+
+#ifndef MEMORY_TRACE
+extern "C" void * calloc(size_t n, size_t size) {
+	NOTE_CALLER();
+	return callocObject(n, size);
+}
+#endif
+
+extern "C" void * realloc(void * ptr, size_t size) {
+	NOTE_CALLER();
+	return reallocObject(ptr, size);
+}
+
+extern "C" void * memalign(size_t alignment, size_t size) {
+	NOTE_CALLER();
+	return memalignObject(alignment, size);
+}
+
+extern "C" void * aligned_alloc(size_t alignment, size_t size) {
+	NOTE_CALLER();
+	return memalignObject(alignment, size);
+}
+
+// unlike the others, reports failures by its result and leaves errno alone
+extern "C" int posix_memalign(void ** memptr, size_t alignment, size_t size) {
+	NOTE_CALLER();
+	if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+
+	int saved_errno = errno;
+	void * ptr = memalignObject(alignment, size);
+	errno = saved_errno;
+	if (ptr == NULL)
+		return ENOMEM;
+
+	*memptr = ptr;
+	return 0;
+}
+
+extern "C" void * valloc(size_t size) {
+	NOTE_CALLER();
+	return memalignObject(PAGE_SIZE, size);
+}
+
+extern "C" void * pvalloc(size_t size) {
+	NOTE_CALLER();
+	return memalignObject(PAGE_SIZE, (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+}
+
+extern "C" void free_sized(void * ptr, size_t size) {
+	vam_free_sized(ptr, size);
+}
+
+// aligned objects may come from the size class of their size rounded up to the alignment, so the size is not used
+extern "C" void free_aligned_sized(void * ptr, size_t, size_t) {
+	free(ptr);
+}
+
+#if __cplusplus >= 201402L
+void operator delete(void * ptr, size_t size) noexcept {
+	vam_free_sized(ptr, size);
+}
+
+void operator delete[](void * ptr, size_t size) noexcept {
+	vam_free_sized(ptr, size);
+}
+#endif
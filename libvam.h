@@ -0,0 +1,192 @@
+/* -*- C -*- */
+
+#ifndef _LIBVAM_H_
+#define _LIBVAM_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* allocate up to n objects of the given size into ptrs, returns the number allocated */
+size_t vam_malloc_batch(size_t size, size_t n, void ** ptrs);
+
+/* free n objects, the order of ptrs is not preserved */
+void vam_free_batch(void ** ptrs, size_t n);
+
+/* free an object with the size it was allocated with, or resized to by realloc(); vam aborts if the size is not that
+   of the object's size class; objects from vam_memalign() and the other aligned allocations may come from the class
+   of the size rounded up to the alignment, so they must not be freed this way */
+void vam_free_sized(void * ptr, size_t size);
+
+/* the usable size of an object allocated with malloc(size) */
+size_t vam_nallocx(size_t size);
+
+/* calloc(), which skips clearing memory that is known to be zero */
+void * vam_calloc(size_t n, size_t size);
+
+/* realloc(), which grows and shrinks low frequency objects in place when possible */
+void * vam_realloc(void * ptr, size_t size);
+
+/* allocate an object aligned to a power of two below 8MB, small objects come from naturally aligned size classes;
+   free it with free(), not with vam_free_sized(); memalign(), posix_memalign(), aligned_alloc(), valloc() and
+   pvalloc() are served the same way */
+void * vam_memalign(size_t alignment, size_t size);
+
+/* save the size class statistics and the set of popular size classes to a file, returns 0 on success */
+int vam_profile_save(const char * path);
+
+/* promote the size classes found popular in a saved profile, returns 0 on success;
+   the profile named by the VAM_PROFILE environment variable is loaded at startup and saved at exit */
+int vam_profile_load(const char * path);
+
+/* a locality group, whose objects are placed on pages of their own */
+typedef struct vam_heap vam_heap_t;
+
+/* create an empty locality group */
+vam_heap_t * vam_heap_create(void);
+
+/* allocate an object in a locality group */
+void * vam_heap_malloc(vam_heap_t * heap, size_t size);
+
+/* free an object of a locality group, which must not be passed to free() */
+void vam_heap_free(vam_heap_t * heap, void * ptr);
+
+/* destroy a locality group and free all its objects at once */
+void vam_heap_destroy(vam_heap_t * heap);
+
+/* a region, which allocates by pointer bumping and frees all its objects at once; a region is not thread-safe */
+typedef struct vam_region vam_region_t;
+
+/* create an empty region */
+vam_region_t * vam_region_create(void);
+
+/* allocate an object in a region */
+void * vam_region_alloc(vam_region_t * region, size_t size);
+
+/* optionally free an object of a region early, its memory is reclaimed once its whole chunk is free */
+void vam_region_free(vam_region_t * region, void * ptr);
+
+/* destroy a region and free all its objects at once */
+void vam_region_destroy(vam_region_t * region);
+
+#define VAM_STATS_MAX_CLASSES	256
+#define VAM_STATS_MAX_TYPES		32
+
+/* statistics of a size class */
+struct vam_class_stats {
+	size_t size;				/* object size */
+	int popular;				/* does it have dedicated subheaps? */
+	size_t allocs;				/* allocations requested, from dedicated subheaps or not */
+	size_t frees;				/* frees of objects in dedicated subheaps */
+	size_t live;				/* live objects in dedicated subheaps */
+	size_t live_bytes;
+	size_t subheaps_created;	/* dedicated subheaps taken from partitions */
+	size_t subheaps_released;	/* dedicated subheaps given back */
+	size_t subheaps_reused;		/* spare subheaps reused instead of creating new ones */
+};
+
+/* statistics of the whole heap */
+struct vam_stats {
+	size_t num_classes;
+	struct vam_class_stats classes[VAM_STATS_MAX_CLASSES];
+
+	/* by partition type, 0 is for the low frequency heap and n for dedicated subheaps of 2^(n-1) pages */
+	size_t num_types;
+	size_t partitions[VAM_STATS_MAX_TYPES];		/* partitions of the type */
+	size_t clusters[VAM_STATS_MAX_TYPES];		/* page clusters in use, that is subheaps or low frequency chunks */
+	size_t resident_pages[VAM_STATS_MAX_TYPES];	/* pages of the partitions of the type in memory, as told by mincore() */
+	size_t discarded_clusters;					/* free page clusters whose pages have been given back to the system */
+	size_t purged_clusters;						/* page clusters given back since the start */
+	size_t released_partitions;					/* partitions unmapped since the start */
+
+	size_t low_freq_allocs;
+	size_t low_freq_frees;
+	size_t low_freq_live_bytes;
+
+	size_t promotions;							/* size classes that got dedicated subheaps */
+	size_t demotions;							/* size classes that lost them again */
+};
+
+/* take a snapshot of the statistics, returns 0 on success; counters are kept per thread and added up
+   every few operations, so the snapshot lacks the last few allocations and frees of other threads */
+int vam_stats_get(struct vam_stats * stats);
+
+/* sample about one allocation every rate bytes, at random, and keep the call stacks of the sampled objects until
+   they are freed, 0 stops sampling; the VAM_SAMPLE_RATE environment variable sets the rate at startup */
+void vam_sample_rate(size_t rate);
+
+/* write the sampled objects still live as a heap profile for pprof, returns 0 on success;
+   with VAM_SAMPLE_SIGNAL set to a signal number, that signal writes the profile to vam.<pid>.<n>.heap */
+int vam_sample_dump(const char * path);
+
+/* write the latency histograms of the slow paths, returns 0 on success; each slow path gets a line with its
+   percentiles in cycles, followed by a "cycles count" line per histogram bucket in use; the slow paths are only
+   timed when vam is built with -DLATENCY_HISTOGRAMS, as libvam_latency.so is */
+int vam_latency_dump(const char * path);
+
+/* clear the latency histograms, to time a phase of the program on its own */
+void vam_latency_reset(void);
+
+#define VAM_STATS_MAGIC		0x5641534dU
+#define VAM_STATS_VERSION	1
+
+/* when the VAM_STATS_INTERVAL environment variable is set to a number of milliseconds, a thread of the process
+   publishes a snapshot of the statistics at that interval into the shared memory file /dev/shm/vam.<pid>,
+   which other processes can map to watch the heap; the allocator itself makes no system call for it */
+struct vam_stats_segment {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int interval;				/* milliseconds between snapshots */
+	unsigned int page_size;
+	volatile unsigned long sequence;	/* odd while the snapshot is being written, read until it is even and unchanged */
+	unsigned long snapshots;			/* snapshots published so far */
+	struct vam_stats stats;
+};
+
+/* write the layout of the whole heap to a binary file for tools/vamlayout, returns 0 on success; with
+   VAM_LAYOUT_SIGNAL set to a signal number, that signal writes the layout to vam.<pid>.<n>.layout;
+   the heap is walked without stopping other threads, so the layout is only as consistent as a glance at it,
+   and partitions that become empty meanwhile are only given back once the walk is over */
+int vam_layout_dump(const char * path);
+
+#define VAM_LAYOUT_MAGIC	0x4c41564dU
+#define VAM_LAYOUT_VERSION	1
+
+/* a layout dump is a vam_layout_header followed by vam_layout_records of these kinds */
+enum {
+	VAM_LAYOUT_PARTITION = 1,	/* a: page clusters, b: free ones, c: discarded ones, d: resident pages of the free ones */
+	VAM_LAYOUT_SUBHEAP,			/* a dedicated subheap; a: object size, b: objects, c: free objects */
+	VAM_LAYOUT_CHUNK,			/* a low frequency chunk; a: bytes in use, b: free bytes, c: largest free block,
+								   d: resident pages inside free blocks */
+	VAM_LAYOUT_FREE_BLOCKS,		/* the free blocks of the chunk at address with sizes in [2^(order-1), 2^order); a: blocks, b: bytes */
+	VAM_LAYOUT_REGION,			/* a chunk of a region */
+	VAM_LAYOUT_HUGE,			/* a huge object in partitions of its own */
+	VAM_LAYOUT_UNKNOWN,			/* a page cluster in use that looks like none of the above, maybe caught while changing */
+};
+
+struct vam_layout_header {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int page_size;
+	unsigned int record_size;
+	unsigned long partition_size;
+};
+
+struct vam_layout_record {
+	unsigned char kind;
+	unsigned char type;			/* partition type */
+	unsigned short order;		/* subheaps span 2^order pages */
+	unsigned int reserved;
+	unsigned long address;
+	unsigned long size;
+	unsigned long resident;		/* pages in memory, as told by mincore() */
+	unsigned long a, b, c, d;
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,241 @@
+// -*- C++ -*-
+
+#ifndef _LIFETIMEHEAP_H_
+#define _LIFETIMEHEAP_H_
+
+#include "vamcommon.h"
+
+#include "onesizeheap.h"
+
+namespace VAM {
+
+// LifetimeHeap: a heap that predicts the lifetime of objects from their allocation sites and allocates
+// long-lived objects from LongHeap, whose subheaps use partition types above LongTypeOffset, and the others from ShortHeap;
+// lifetimes are learned by sampling allocations; a site is the caller of an entry point, which the entry point notes with setCaller()
+// because the layers in between are not always inlined into it, and an allocation that none noted counts for the last site noted;
+// it must sit above any thread cache, which would otherwise hide frees and mix the objects of both heaps
+template<class ShortHeap, class LongHeap, unsigned char LongTypeOffset>
+class LifetimeHeap : public ShortHeap {
+
+public:
+
+	inline static void setCaller(void * caller) {
+		_caller = caller;
+	}
+
+	inline void * malloc(size_t size) {
+		size_t site = getSite();
+		void * ptr;
+
+		if (isLongLived(site))
+			ptr = _long_heap.malloc(size);
+		else
+			ptr = ShortHeap::malloc(size);
+
+		if (ptr != NULL && --_sample_countdown <= 0)
+			sample(ptr, site);
+
+		return ptr;
+	}
+
+	inline void * calloc(size_t size) {
+		size_t site = getSite();
+		void * ptr;
+
+		if (isLongLived(site))
+			ptr = _long_heap.calloc(size);
+		else
+			ptr = ShortHeap::calloc(size);
+
+		if (ptr != NULL && --_sample_countdown <= 0)
+			sample(ptr, site);
+
+		return ptr;
+	}
+
+	inline size_t mallocBatch(size_t size, void ** ptrs, size_t n) {
+		if (isLongLived(getSite()))
+			return _long_heap.mallocBatch(size, ptrs, n);
+		else
+			return ShortHeap::mallocBatch(size, ptrs, n);
+	}
+
+	inline void free(void * ptr) {
+		checkSample(ptr);
+
+		if (isLongHeap(ptr))
+			_long_heap.free(ptr);
+		else
+			ShortHeap::free(ptr);
+	}
+
+	inline void free(void * ptr, size_t size) {
+		checkSample(ptr);
+
+		if (isLongHeap(ptr))
+			_long_heap.free(ptr, size);
+		else
+			ShortHeap::free(ptr, size);
+	}
+
+	inline void freeUncached(void * ptr, size_t size) {
+		checkSample(ptr);
+
+		if (isLongHeap(ptr))
+			_long_heap.freeUncached(ptr, size);
+		else
+			ShortHeap::freeUncached(ptr, size);
+	}
+
+	inline void flushCache(size_t index) {
+		ShortHeap::flushCache(index);
+		_long_heap.flushCache(index);
+	}
+
+	// free n objects sorted by address, the objects of each heap are in their own partitions and hence adjacent
+	inline void freeBatch(void ** ptrs, size_t n) {
+		size_t i = 0;
+		while (i < n) {
+			bool is_long = isLongHeap(ptrs[i]);
+			size_t j = i;
+			do {
+				checkSample(ptrs[j]);
+				j++;
+			} while (j < n && isLongHeap(ptrs[j]) == is_long);
+
+			if (is_long)
+				_long_heap.freeBatch(ptrs + i, j - i);
+			else
+				ShortHeap::freeBatch(ptrs + i, j - i);
+			i = j;
+		}
+	}
+
+	inline size_t getSize(void * ptr) {
+		if (isLongHeap(ptr))
+			return _long_heap.getSize(ptr);
+		else
+			return ShortHeap::getSize(ptr);
+	}
+
+	// the churn of the subheaps of a size class in both heaps
+	inline ChurnStats getChurnStats(size_t index) {
+		ChurnStats stats = ShortHeap::getChurnStats(index);
+		const ChurnStats & long_stats = _long_heap.getChurnStats(index);
+		stats.created += long_stats.created;
+		stats.released += long_stats.released;
+		stats.reused += long_stats.reused;
+		return stats;
+	}
+
+	inline void releaseIdleSpare(size_t index) {
+		ShortHeap::releaseIdleSpare(index);
+		_long_heap.releaseIdleSpare(index);
+	}
+
+private:
+
+	enum {
+		NUM_SITES = 4096,
+		NUM_SAMPLES = 1024,
+		SAMPLE_PERIOD = 64,
+		LONG_LIFETIME = 256,	// in samples, that is about LONG_LIFETIME * SAMPLE_PERIOD allocations
+		MAX_VOTES = 64,
+	};
+
+	// what the sampled objects of a site have told us about their lifetimes
+	struct SiteStats {
+		unsigned short short_votes;
+		unsigned short long_votes;
+	};
+
+	struct Sample {
+		void * ptr;
+		size_t site;
+		size_t birth;
+	};
+
+	LongHeap _long_heap;
+
+	// shared by all threads
+	static SiteStats _sites[NUM_SITES];
+	static Sample _samples[NUM_SAMPLES];
+	static size_t _clock;
+
+	static __thread int _sample_countdown;
+	static __thread void * _caller;
+
+	inline size_t getSite() {
+		size_t site = reinterpret_cast<size_t>(_caller);
+		return (site ^ (site >> 12)) % NUM_SITES;
+	}
+
+	inline bool isLongLived(size_t site) {
+		return _sites[site].long_votes > _sites[site].short_votes;
+	}
+
+	inline bool isLongHeap(void * ptr) {
+		return ShortHeap::ptrToType(ptr) > LongTypeOffset;
+	}
+
+	inline static size_t hashPtr(void * ptr) {
+		return (reinterpret_cast<size_t>(ptr) >> 4) % NUM_SAMPLES;
+	}
+
+	// the tables are updated without locks, a lost or misattributed vote only weakens a prediction
+	void sample(void * ptr, size_t site) {
+		_sample_countdown = SAMPLE_PERIOD;
+		size_t now = __sync_add_and_fetch(&_clock, 1);
+
+		// an old sample that is still alive counts as long-lived
+		Sample * s = &_samples[hashPtr(ptr)];
+		if (s->ptr != NULL && now - s->birth > LONG_LIFETIME)
+			vote(s->site, true);
+
+		s->ptr = ptr;
+		s->site = site;
+		s->birth = now;
+	}
+
+	inline void checkSample(void * ptr) {
+		Sample * s = &_samples[hashPtr(ptr)];
+		if (s->ptr == ptr) {
+			vote(s->site, _clock - s->birth > LONG_LIFETIME);
+			s->ptr = NULL;
+		}
+	}
+
+	void vote(size_t site, bool is_long) {
+		SiteStats * stats = &_sites[site];
+		if (is_long)
+			stats->long_votes++;
+		else
+			stats->short_votes++;
+
+		// halve the votes from time to time, so that sites can change their minds
+		if (stats->long_votes + stats->short_votes > MAX_VOTES) {
+			stats->long_votes /= 2;
+			stats->short_votes /= 2;
+		}
+	}
+
+};	// end of class LifetimeHeap
+
+template<class ShortHeap, class LongHeap, unsigned char LongTypeOffset>
+typename LifetimeHeap<ShortHeap, LongHeap, LongTypeOffset>::SiteStats LifetimeHeap<ShortHeap, LongHeap, LongTypeOffset>::_sites[NUM_SITES];
+
+template<class ShortHeap, class LongHeap, unsigned char LongTypeOffset>
+typename LifetimeHeap<ShortHeap, LongHeap, LongTypeOffset>::Sample LifetimeHeap<ShortHeap, LongHeap, LongTypeOffset>::_samples[NUM_SAMPLES];
+
+template<class ShortHeap, class LongHeap, unsigned char LongTypeOffset>
+size_t LifetimeHeap<ShortHeap, LongHeap, LongTypeOffset>::_clock;
+
+template<class ShortHeap, class LongHeap, unsigned char LongTypeOffset>
+__thread int LifetimeHeap<ShortHeap, LongHeap, LongTypeOffset>::_sample_countdown;
+
+template<class ShortHeap, class LongHeap, unsigned char LongTypeOffset>
+__thread void * LifetimeHeap<ShortHeap, LongHeap, LongTypeOffset>::_caller;
+
+};	// end of namespace VAM
+
+#endif
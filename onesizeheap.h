@@ -7,84 +7,126 @@
 
 namespace VAM {
 
-// OneSizeHeap: a heap that allocates objects of a fixed size and creates new subheaps in exponentially increasing sizes
-template <unsigned char MaxSubHeapType, class SubHeap, class SuperHeap>
+// how often the subheaps of a OneSizeHeap come and go
+struct ChurnStats {
+	size_t created;		// subheaps taken from SuperHeap
+	size_t released;	// subheaps returned to SuperHeap
+	size_t reused;		// spare subheaps reused instead of creating new ones
+};
+
+// OneSizeHeap: a heap that allocates objects of a fixed size and creates new subheaps in sizes adapted to its demand,
+// the partition type of a subheap is its order plus TypeOffset, so that heaps with different offsets never share partitions
+template <unsigned char MaxSubHeapType, class SubHeap, class SuperHeap, unsigned char TypeOffset = 0>
 class OneSizeHeap : public SuperHeap {
 
 public:
 
-	OneSizeHeap() : _object_size(0), _next_subheap_type(1) {
+	OneSizeHeap() : _object_size(0), _min_subheap_type(1), _max_subheap_type(MaxSubHeapType), _next_subheap_type(1), _next_color(0),
+		_num_live(0), _allocs_since_create(0), _spare(NULL), _spare_age(0), _spare_ticked(false) {
 		INIT_LIST_HEAD(&_full_subheap_list);
-		INIT_LIST_HEAD(&_avai_subheap_list);
+		for (int bucket = 0; bucket < NUM_BUCKETS; bucket++)
+			INIT_LIST_HEAD(&_avai_subheap_lists[bucket]);
+		memset(&_churn, 0, sizeof(_churn));
 
 		dbprintf("OneSizeHeap: sizeof(SubHeap)=%u\n", sizeof(SubHeap));
 	}
 
+	// free all subheaps in bulk, including the objects still allocated in them
 	~OneSizeHeap() {
-		// free all subheaps
-		while (!list_empty(&_full_subheap_list)) {
-			list_head * node = _full_subheap_list.next;
-			SubHeap * subheap = SubHeap::listToHeap(node);
-			assert(subheap->getList() == node);
+		freeSubHeaps(&_full_subheap_list);
+		for (int bucket = 0; bucket < NUM_BUCKETS; bucket++)
+			freeSubHeaps(&_avai_subheap_lists[bucket]);
+		if (_spare != NULL)
+			SuperHeap::free(getSpace(_spare));
+	}
 
-			removeSubHeap(subheap);
-		}
-		while (!list_empty(&_avai_subheap_list)) {
-			list_head * node = _avai_subheap_list.next;
-			SubHeap * subheap = SubHeap::listToHeap(node);
-			assert(subheap->getList() == node);
+	inline void * malloc(size_t size) {
+		bool zero;
+		return allocate(size, zero);
+	}
+
+	// allocate a zeroed object, clearing it only if it has been used before
+	inline void * calloc(size_t size) {
+		bool zero;
+		void * ptr = allocate(size, zero);
+		if (ptr != NULL && !zero)
+			memset(ptr, 0, size);
+		return ptr;
+	}
+
+	inline void free(void * ptr) {
+		sanityCheck();
+
+		SubHeap * subheap = getSubHeap(ptr);
+		int bucket = getBucket(subheap);
+		subheap->free(ptr);
+		_num_live--;
+		ageSpare();
 
+		if (subheap->getNumFree() == subheap->getNumTotal())
 			removeSubHeap(subheap);
-		}
+		else if (subheap->getNumFree() == 1 || getBucket(subheap) != bucket)
+			fileSubHeap(subheap);
+
+		sanityCheck();
 	}
 
-	inline void * malloc(size_t size) {
+	// allocate up to n objects and return the number allocated
+	inline size_t mallocBatch(size_t size, void ** ptrs, size_t n) {
 		sanityCheck();
 
-		void * ptr = NULL;
+		size_t num = 0;
 		assert(_object_size == 0 || size == _object_size);
-		assert(size < PAGE_SIZE);
 		SubHeap * subheap;
 
 		// the first allocation sets the fixed object size
 		if (_object_size == 0)
-			_object_size = size;
-
-		// allocate the object in an available subheap
-		while (!list_empty(&_avai_subheap_list)) {
-			subheap = SubHeap::listToHeap(_avai_subheap_list.next);
-			ptr = subheap->malloc();
-			if (ptr != NULL)
-				break;
-			assert(subheap->getNumFree() == 0);
-			list_move(subheap->getList(), &_full_subheap_list);
-		}
-
-		// if all subheaps are full, create a new one
-		if (ptr == NULL) {
-			subheap = createSubHeap();
-			if (subheap != NULL) {
-				ptr = subheap->malloc();
-				assert(ptr != NULL);
+			setObjectSize(size);
+
+		// fill up the batch from the fullest available subheaps first, then from new ones
+		while (num < n) {
+			subheap = getAvailableSubHeap();
+			if (subheap == NULL) {
+				subheap = createSubHeap();
+				if (subheap == NULL)
+					break;
 			}
+
+			num += subheap->mallocBatch(ptrs + num, n - num);
+			fileSubHeap(subheap);
 		}
+		_num_live += num;
+		_allocs_since_create += num;
+		ageSpare(num);
 
-		assert(ptr == NULL || getSubHeap(ptr) == subheap);
 		sanityCheck();
 
-		return ptr;
+		return num;
 	}
 
-	inline void free(void * ptr) {
+	// free n objects sorted by address, so that objects in the same subheap are adjacent
+	inline void freeBatch(void ** ptrs, size_t n) {
 		sanityCheck();
 
-		SubHeap * subheap = getSubHeap(ptr);
-		subheap->free(ptr);
+		_num_live -= n;
+		ageSpare(n);
 
-		if (subheap->getNumFree() == 1)
-			list_move(subheap->getList(), &_avai_subheap_list);
-		else if (subheap->getNumFree() == subheap->getNumTotal())
-			removeSubHeap(subheap);
+		size_t i = 0;
+		while (i < n) {
+			SubHeap * subheap = getSubHeap(ptrs[i]);
+			bool was_full = (subheap->getNumFree() == 0);
+			int bucket = getBucket(subheap);
+
+			do {
+				assert(i == 0 || reinterpret_cast<size_t>(ptrs[i - 1]) < reinterpret_cast<size_t>(ptrs[i]));
+				subheap->free(ptrs[i++]);
+			} while (i < n && getSubHeap(ptrs[i]) == subheap);
+
+			if (subheap->getNumFree() == subheap->getNumTotal())
+				removeSubHeap(subheap);
+			else if (was_full || getBucket(subheap) != bucket)
+				fileSubHeap(subheap);
+		}
 
 		sanityCheck();
 	}
@@ -93,6 +135,20 @@ public:
 		return getSubHeap(ptr)->getObjectSize();
 	}
 
+	inline const ChurnStats & getChurnStats() {
+		return _churn;
+	}
+
+	// release the spare if it has been kept since the last call; meant to be called on a clock shared by all size classes,
+	// so that the spares of idle ones, which do not age by their own allocations and frees, go after a while too
+	inline void releaseIdleSpare() {
+		if (_spare != NULL && _spare_ticked) {
+			releaseSubHeap(_spare);
+			_spare = NULL;
+		}
+		_spare_ticked = true;
+	}
+
 	void sanityCheck() {
 #ifdef DEBUG
 #if SANITY_CHECK
@@ -100,7 +156,7 @@ public:
 			list_head * node = _full_subheap_list.next;
 			while (node != &_full_subheap_list) {
 				SubHeap * subheap = SubHeap::listToHeap(node);
-				assert(reinterpret_cast<size_t>(subheap) % PAGE_SIZE == 0);
+				assert(reinterpret_cast<size_t>(getSpace(subheap)) % PAGE_SIZE == 0);
 				assert(subheap->getObjectSize() == _object_size);
 				assert(subheap->getNumFree() == 0);
 				assert(subheap->getList() == node);
@@ -109,13 +165,14 @@ public:
 			}
 		}
 
-		if (!list_empty(&_avai_subheap_list)) {
-			list_head * node = _avai_subheap_list.next;
-			while (node != &_avai_subheap_list) {
+		for (int bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+			list_head * node = _avai_subheap_lists[bucket].next;
+			while (node != &_avai_subheap_lists[bucket]) {
 				SubHeap * subheap = SubHeap::listToHeap(node);
-				assert(reinterpret_cast<size_t>(subheap) % PAGE_SIZE == 0);
+				assert(reinterpret_cast<size_t>(getSpace(subheap)) % PAGE_SIZE == 0);
 				assert(subheap->getObjectSize() == _object_size);
-				assert(subheap->getNumFree() <= subheap->getNumTotal());
+				assert(subheap->getNumFree() > 0 && subheap->getNumFree() <= subheap->getNumTotal());
+				assert(getBucket(subheap) == bucket);
 				assert(subheap->getList() == node);
 
 				node = node->next;
@@ -127,46 +184,241 @@ public:
 
 private:
 
+	enum {
+		MIN_OBJECTS_PER_SUBHEAP = 4,
+		MAX_SUBHEAP_GROWTH = 4,
+		NUM_BUCKETS = 4,
+		SPARE_LIFETIME = 4096,	// in allocations and frees
+	};
+
+	// available subheaps are bucketed by occupancy and the fullest ones are allocated from first,
+	// so that live objects gather in few subheaps and the others can empty out and be returned
 	list_head _full_subheap_list;
-	list_head _avai_subheap_list;
+	list_head _avai_subheap_lists[NUM_BUCKETS];
 
 	size_t _object_size;
+	unsigned char _min_subheap_type;
+	unsigned char _max_subheap_type;
 	unsigned char _next_subheap_type;
+	unsigned int _next_color;
 
-	// create a new subheap with doubled size
-	inline SubHeap * createSubHeap() {
-		size_t subheap_size = PAGE_SIZE << (_next_subheap_type - 1);
-		SubHeap * subheap = reinterpret_cast<SubHeap *>(SuperHeap::malloc(subheap_size, _next_subheap_type));
-		assert(subheap != NULL);
-		assert(reinterpret_cast<size_t>(subheap) % subheap_size == 0);
+	// the demand that decides the size of new subheaps
+	size_t _num_live;
+	size_t _allocs_since_create;
+
+	// an empty subheap kept for a while, so that a size class hovering around a subheap boundary
+	// does not go back and forth to SuperHeap
+	SubHeap * _spare;
+	size_t _spare_age;
+	bool _spare_ticked;		// has the shared clock ticked since the spare was kept?
+
+	ChurnStats _churn;
+
+	// objects larger than a page start from subheaps of several pages, each holding a few objects after the metadata,
+	// and so do objects whose out-of-line metadata would not fit in the slot of a smaller subheap
+	inline void setObjectSize(size_t size) {
+		_object_size = size;
+
+		while (_min_subheap_type < MaxSubHeapType && (getCapacity(_min_subheap_type) < MIN_OBJECTS_PER_SUBHEAP
+			|| !metadataFits(PAGE_SIZE << (_min_subheap_type - 1))))
+			_min_subheap_type++;
+		assert(getCapacity(_min_subheap_type) >= MIN_OBJECTS_PER_SUBHEAP);
+
+		_max_subheap_type = _min_subheap_type + MAX_SUBHEAP_GROWTH;
+		if (_max_subheap_type > MaxSubHeapType)
+			_max_subheap_type = MaxSubHeapType;
+
+		_next_subheap_type = _min_subheap_type;
+
+		// each size starts at a different cache color
+		_next_color = size;
+	}
+
+	// allocate an object and tell whether its memory is known to be zero
+	inline void * allocate(size_t size, bool & zero) {
+		sanityCheck();
+
+		void * ptr = NULL;
+		zero = false;
+		assert(_object_size == 0 || size == _object_size);
+		SubHeap * subheap;
+
+		// the first allocation sets the fixed object size
+		if (_object_size == 0)
+			setObjectSize(size);
+
+		// allocate the object in the fullest available subheap, if all subheaps are full, create a new one
+		subheap = getAvailableSubHeap();
+		if (subheap == NULL)
+			subheap = createSubHeap();
 
 		if (subheap != NULL) {
-			// initialize the new subheap
-			subheap = new (subheap) SubHeap(subheap_size, _object_size);
+			int bucket = getBucket(subheap);
+			zero = subheap->nextIsZero();
+			ptr = subheap->malloc();
+			assert(ptr != NULL);
+
+			if (subheap->getNumFree() == 0 || getBucket(subheap) != bucket)
+				fileSubHeap(subheap);
 
-			list_add(subheap->getList(), &_avai_subheap_list);
-			if (_next_subheap_type < MaxSubHeapType)
-				_next_subheap_type++;
+			_num_live++;
+			_allocs_since_create++;
+			ageSpare();
 		}
+
+		assert(ptr == NULL || getSubHeap(ptr) == subheap);
+		sanityCheck();
+
+		return ptr;
+	}
+
+	inline bool metadataFits(size_t subheap_size) {
+		return !SuperHeap::OUT_OF_LINE_METADATA
+			|| sizeof(SubHeap) + SubHeap::getMapSize(subheap_size, _object_size) <= subheap_size / SuperHeap::METADATA_RATIO;
+	}
+
+	// the objects a subheap of the given type holds; in-line metadata come first, and the objects start at the next
+	// boundary they are aligned to, which for sizes that are multiples of a page is a whole page past the header
+	inline size_t getCapacity(unsigned char type) {
+		size_t subheap_size = PAGE_SIZE << (type - 1);
+		if (SuperHeap::OUT_OF_LINE_METADATA)
+			return subheap_size / _object_size;
+
+		size_t alignment = SubHeap::getAlignment(_object_size);
+		size_t metadata_size = sizeof(SubHeap) + SubHeap::getMapSize(subheap_size - sizeof(SubHeap), _object_size);
+		return (subheap_size - ((metadata_size + alignment - 1) & ~(alignment - 1))) / _object_size;
+	}
+
+	// create a new subheap, or bring back the spare one; subheaps grow when there are at least half as many live objects
+	// as the next one would hold and that many have been allocated since the last one was created, so a steadily
+	// growing size class doubles them while one that merely churns does not
+	inline SubHeap * createSubHeap() {
+		if (_spare != NULL) {
+			SubHeap * subheap = _spare;
+			_spare = NULL;
+			_churn.reused++;
+			_allocs_since_create = 0;
+
+			void * space = getSpace(subheap);
+			unsigned char type = SuperHeap::ptrToType(space) - TypeOffset;
+			return initSubHeap(space, PAGE_SIZE << (type - 1), false);
+		}
+
+		if (_next_subheap_type < _max_subheap_type && _num_live * 2 >= getCapacity(_next_subheap_type)
+			&& _allocs_since_create * 2 >= getCapacity(_next_subheap_type))
+			_next_subheap_type++;
+		_allocs_since_create = 0;
+
+		size_t subheap_size = PAGE_SIZE << (_next_subheap_type - 1);
+		void * space = SuperHeap::malloc(subheap_size, TypeOffset + _next_subheap_type);
+		assert(space != NULL);
+		assert(reinterpret_cast<size_t>(space) % subheap_size == 0);
+
+		if (space == NULL)
+			return NULL;
+
+		_churn.created++;
+
+		// a discarded page cluster needs no clearing
+		return initSubHeap(space, subheap_size, SuperHeap::isKnownZero(space));
+	}
+
+	inline SubHeap * initSubHeap(void * space, size_t subheap_size, bool zeroed) {
+#ifdef NO_CACHE_COLORING
+		unsigned int color = 0;
+#else
+		unsigned int color = _next_color++;
+#endif
+
+		// with out-of-line metadata the objects take all of the space, and a header and map too large for the slot
+		// of the subheap would overwrite the metadata of the next one
+		abort_on(!metadataFits(subheap_size));
+		SubHeap * subheap = new (SuperHeap::getMetadata(space)) SubHeap(subheap_size, _object_size, zeroed,
+			SuperHeap::OUT_OF_LINE_METADATA ? space : NULL, color);
+
+		list_add(subheap->getList(), &_avai_subheap_lists[getBucket(subheap)]);
 		return subheap;
 	}
 
-	// remove the subheap when it's empty
+	// remove the subheap when it's empty, keeping it as the spare if there is none;
+	// subheaps shrink once fewer than a quarter of what the next one would hold are live
 	inline void removeSubHeap(SubHeap * subheap) {
 		assert(subheap->getNumFree() == subheap->getNumTotal());
 		list_del(subheap->getList());
-		SuperHeap::free(subheap);
 
-		if (_next_subheap_type > 1)
+		if (_spare == NULL) {
+			_spare = subheap;
+			_spare_age = 0;
+			_spare_ticked = false;
+		}
+		else
+			releaseSubHeap(subheap);
+
+		if (_next_subheap_type > _min_subheap_type && _num_live * 4 < getCapacity(_next_subheap_type))
 			_next_subheap_type--;
 	}
 
+	inline void releaseSubHeap(SubHeap * subheap) {
+		SuperHeap::free(getSpace(subheap));
+		_churn.released++;
+	}
+
+	// release the spare if it has not been needed for a while
+	inline void ageSpare(size_t n = 1) {
+		if (_spare != NULL && (_spare_age += n) > SPARE_LIFETIME) {
+			releaseSubHeap(_spare);
+			_spare = NULL;
+		}
+	}
+
+	// the bucket of a subheap with free objects: up to a quarter of them free, up to a half, up to three quarters, more
+	inline static int getBucket(SubHeap * subheap) {
+		size_t num_free = subheap->getNumFree() * NUM_BUCKETS;
+		size_t num_total = subheap->getNumTotal();
+		return (num_free > num_total) + (num_free > 2 * num_total) + (num_free > 3 * num_total);
+	}
+
+	// put a subheap on the full list or in the bucket for its occupancy
+	inline void fileSubHeap(SubHeap * subheap) {
+		if (subheap->getNumFree() == 0)
+			list_move(subheap->getList(), &_full_subheap_list);
+		else
+			list_move(subheap->getList(), &_avai_subheap_lists[getBucket(subheap)]);
+	}
+
+	inline SubHeap * getAvailableSubHeap() {
+		for (int bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+			if (!list_empty(&_avai_subheap_lists[bucket]))
+				return SubHeap::listToHeap(_avai_subheap_lists[bucket].next);
+		}
+		return NULL;
+	}
+
+	void freeSubHeaps(list_head * list) {
+		while (!list_empty(list)) {
+			list_head * node = list->next;
+			SubHeap * subheap = SubHeap::listToHeap(node);
+			assert(subheap->getList() == node);
+
+			list_del(node);
+			SuperHeap::free(getSpace(subheap));
+		}
+	}
+
 	// find the subheap from any address inside the subheap
 	inline SubHeap * getSubHeap(void * ptr) {
-		unsigned char type = SuperHeap::ptrToType(ptr);
-		assert(type != 0);
+		unsigned char type = SuperHeap::ptrToType(ptr) - TypeOffset;
+		assert(type != 0 && type <= MaxSubHeapType);
+
+		void * space = reinterpret_cast<void *>(reinterpret_cast<size_t>(ptr) & (PAGE_MASK << (type - 1)));
+		return reinterpret_cast<SubHeap *>(SuperHeap::getMetadata(space));
+	}
 
-		SubHeap * subheap = reinterpret_cast<SubHeap *>(reinterpret_cast<size_t>(ptr) & (PAGE_MASK << (type - 1)));
+	// the memory of a subheap, which starts with the subheap itself unless its metadata are out of line,
+	// then it starts at the allocation base less the color
+	inline void * getSpace(SubHeap * subheap) {
+		if (SuperHeap::OUT_OF_LINE_METADATA)
+			return reinterpret_cast<void *>(reinterpret_cast<size_t>(subheap->getBasePtr()) & PAGE_MASK);
 		return subheap;
 	}
 
@@ -4,6 +4,7 @@
 #define _PAGECLUSTERHEAP_H_
 
 #include "vamcommon.h"
+#include "latencyhistogram.h"
 
 namespace VAM {
 
@@ -22,6 +23,8 @@ public:
 		  _num_discarded(_num_clusters),
 		  _num_pages(heap_size >> PAGE_SHIFT) {
 
+		LatencyTimer timer(LATENCY_CLUSTER_INIT);
+
 		assert(heap_size != 0 && (heap_size & ~PAGE_MASK) == 0);
 		assert(heap_alignment != 0 && (heap_alignment & ~PAGE_MASK) == 0 && (heap_alignment & (heap_alignment - 1)) == 0);
 		assert(cluster_size != 0 && (cluster_size & ~PAGE_MASK) == 0 && heap_size % cluster_size == 0);
@@ -45,7 +48,7 @@ public:
 		dbprintf("PageClusterHeap: cluster_map_size=%d _cluster_map=%p\n", cluster_map_size, _cluster_map);
 		assert(_cluster_map != NULL);
 		abort_on(_cluster_map == NULL);
-		memset(_cluster_map, 0, cluster_map_size);
+		// no need to clear the maps, fresh mappings from SuperHeap are zero
 
 		size_t page_map_size = _num_pages * sizeof(unsigned char);
 		page_map_size = (page_map_size + PAGE_SIZE - 1) & PAGE_MASK;
@@ -53,7 +56,6 @@ public:
 		dbprintf("PageClusterHeap: page_map_size=%d _page_map=%p\n", page_map_size, _page_map);
 		assert(_page_map != NULL);
 		abort_on(_page_map == NULL);
-		memset(_page_map, 0, page_map_size);
 
 		// initially all page clusters are free and discarded (because the PTEs are empty at this time)
 		INIT_LIST_HEAD(&_free_list);
@@ -158,6 +160,23 @@ public:
 		return _num_free == 0;
 	}
 
+	inline size_t getNumUsed() {
+		return _num_clusters - _num_free;
+	}
+
+	inline size_t getNumDiscarded() {
+		return _num_discarded;
+	}
+
+	// call visitor.visitCluster(ptr, size, is_free, is_discarded) for every page cluster, in address order
+	template<class Visitor>
+	void visitClusters(Visitor & visitor) {
+		for (size_t i = 0; i < _num_clusters; i++) {
+			ClusterMap * map = &_cluster_map[i];
+			visitor.visitCluster(clusterMapToPtr(map), _cluster_size, map->flagsOn(CLUSTER_FREE), map->flagsOn(CLUSTER_DISCARDED));
+		}
+	}
+
 	void sanityCheck() {
 #ifdef DEBUG
 #if SANITY_CHECK
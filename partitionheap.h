@@ -3,7 +3,10 @@
 #ifndef _PARTITIONHEAP_H_
 #define _PARTITIONHEAP_H_
 
+#include <sys/mman.h>
+
 #include "vamcommon.h"
+#include "latencyhistogram.h"
 
 namespace VAM {
 
@@ -24,6 +27,10 @@ public:
 		memset(_subheap_list, 0 ,sizeof(_subheap_list));
 		memset(_subheap_map, 0, sizeof(_subheap_map));
 		memset(_subheap_pool, 0, sizeof(_subheap_pool));
+		_num_purged = 0;
+		_num_released = 0;
+		_num_visitors = 0;
+		INIT_LIST_HEAD(&_deferred_list);
 
 		for (size_t i = 0; i < NumPartitions; i++) {
 			_type_map[i] = INVALID_TYPE;
@@ -74,6 +81,7 @@ public:
 
 			// no subheap available for allocation, create one
 			if (_unused_subheaps != NULL) {
+				LatencyTimer timer(LATENCY_SUBHEAP_CREATE);
 				SubHeapInstance * instance = _unused_subheaps;
 				SubHeap * heap = new (instance->space) SubHeap(PartitionSize, PartitionSize, size);
 				assert(heap == reinterpret_cast<SubHeap *>(&instance->space));
@@ -108,10 +116,12 @@ public:
 		// huge allocations that occupy more than one partition
 		else {
 
-			// create a special subheap that can only allocate one huge object
+			// create a special subheap that can only allocate one huge object, aligned to a partition so that
+			// objects aligned within it are still in the partition it is known by
 			if (_unused_subheaps != NULL) {
+				LatencyTimer timer(LATENCY_HUGE_CREATE);
 				SubHeapInstance * instance = _unused_subheaps;
-				SubHeap * heap = new (instance->space) SubHeap(size, PAGE_SIZE, size);
+				SubHeap * heap = new (instance->space) SubHeap(size, PartitionSize, size);
 				assert(heap == reinterpret_cast<SubHeap *>(&instance->space));
 
 				void * heap_address = heap->getHeapAddress();
@@ -161,26 +171,18 @@ public:
 		SubHeapList * list = &_subheap_list[type];
 		SubHeapMap * map = ptrToMap(ptr);
 		map->heap->free(ptr);
+		if (map->heap->isDiscarded(ptr))
+			__sync_fetch_and_add(&_num_purged, 1);
 
-		// destroy the subheap if it's empty and not the only one left
+		// destroy the subheap if it's empty and not the only one left, or leave that to a free after the visit
+		// of the partitions that may be reading it
 		if (map->heap->isEmpty() && (map->list.prev != &list->avai || map->list.next != &list->avai)) {
-			list_del(&map->list);
-
-			void * heap_address = map->heap->getHeapAddress();
-			assert(heap_address != NULL);
-			assert(map == ptrToMap(heap_address));
-			_type_map[ptrToPartition(heap_address)] = INVALID_TYPE;
-
-			map->heap->~SubHeap();
-
-			SubHeapInstance * instance = container_of(reinterpret_cast<const char (*) [sizeof(SubHeap)]>(map->heap), SubHeapInstance, space);
-
-//			SubHeapInstance * instance = reinterpret_cast<SubHeapInstance *>(reinterpret_cast<size_t>(map->heap) - reinterpret_cast<size_t>(&reinterpret_cast<SubHeapInstance *>(0)->space));
-
-			instance->next_unused = _unused_subheaps;
-			_unused_subheaps = instance;
-
-			memset(map, 0, sizeof(SubHeapMap));
+			if (hidePartition(ptrToPartition(map->heap->getHeapAddress())))
+				releaseSubHeap(map);
+			else {
+				list_move(&map->list, &_deferred_list);
+				map->status = SUBHEAP_DEFERRED;
+			}
 		}
 		// move the subheap if necessary
 		else if (map->status == SUBHEAP_FULL) {
@@ -188,14 +190,87 @@ public:
 			map->status = SUBHEAP_AVAI;
 		}
 
+		if (!list_empty(&_deferred_list) && _num_visitors == 0)
+			releaseDeferred();
+
 		sanityCheck();
 	}
 
+	// is the page cluster just allocated at ptr known to be zero?
+	inline bool isKnownZero(void * ptr) {
+		return ptrToMap(ptr)->heap->isDiscarded(ptr);
+	}
+
+	// add up the partitions and the page clusters in use of each type, and the free clusters that have been discarded;
+	// the maps are read without stopping other threads, so the counts are only as consistent as a glance at them
+	void getStats(size_t * partitions, size_t * clusters, size_t * discarded) {
+		memset(partitions, 0, PartitionTypes * sizeof(size_t));
+		memset(clusters, 0, PartitionTypes * sizeof(size_t));
+		*discarded = 0;
+
+		for (size_t i = 0; i < NumPartitions; i++) {
+			unsigned char type = _type_map[i];
+			SubHeap * heap = _subheap_map[i].heap;
+			if (type == INVALID_TYPE || heap == NULL)
+				continue;
+
+			partitions[type]++;
+			clusters[type] += heap->getNumUsed();
+			*discarded += heap->getNumDiscarded();
+		}
+	}
+
+	// count the resident pages of the partitions of each type with mincore(), which takes a system call per
+	// RESIDENCY_CHUNK pages, so this is meant for a monitor that looks from time to time, not for the allocation paths
+	void getResidentPages(size_t * resident) {
+		memset(resident, 0, PartitionTypes * sizeof(size_t));
+
+		unsigned char vec[RESIDENCY_CHUNK];
+		for (size_t i = 0; i < NumPartitions; i++) {
+			unsigned char type = _type_map[i];
+			SubHeap * heap = _subheap_map[i].heap;
+			if (type == INVALID_TYPE || heap == NULL)
+				continue;
+
+			size_t address = reinterpret_cast<size_t>(heap->getHeapAddress());
+			size_t num_pages = heap->getHeapSize() / PAGE_SIZE;
+			for (size_t page = 0; page < num_pages; page += RESIDENCY_CHUNK) {
+				size_t n = num_pages - page < RESIDENCY_CHUNK ? num_pages - page : static_cast<size_t>(RESIDENCY_CHUNK);
+				if (mincore(reinterpret_cast<void *>(address + page * PAGE_SIZE), n * PAGE_SIZE, vec) != 0)
+					break;
+				for (size_t j = 0; j < n; j++)
+					resident[type] += vec[j] & 1;
+			}
+		}
+	}
+
+	// the free page clusters given back with madvise() and the partitions unmapped since the start
+	void getPurgeCounts(size_t * purged, size_t * released) {
+		*purged = _num_purged;
+		*released = _num_released;
+	}
+
+	// call visitor.visitPartition(type, heap) for every partition in use, in address order; huge objects count once,
+	// in the first partition they span, and the subheaps are walked without stopping other threads, but none is
+	// released until the walk is over
+	template<class Visitor>
+	void visitPartitions(Visitor & visitor) {
+		__sync_fetch_and_add(&_num_visitors, 1);
+		for (size_t i = 0; i < NumPartitions; i++) {
+			unsigned char type = _type_map[i];
+			SubHeap * heap = _subheap_map[i].heap;
+			if (type != INVALID_TYPE && heap != NULL)
+				visitor.visitPartition(type, heap);
+		}
+		__sync_fetch_and_sub(&_num_visitors, 1);
+	}
+
 	void sanityCheck() {
 #ifdef DEBUG
 #if 1//SANITY_CHECK
 		size_t num_avai = 0;
 		size_t num_full = 0;
+		size_t num_deferred = 0;
 		size_t num_unused_instances = 0;
 		size_t num_unused_partitions = 0;
 
@@ -233,6 +308,18 @@ public:
 			}
 		}
 
+		list_head * node = _deferred_list.next;
+		while (node != &_deferred_list) {
+			assert(node->prev->next == node && node->next->prev == node);
+
+			SubHeapMap * map = list_entry(node, SubHeapMap, list);
+			assert(map->status == SUBHEAP_DEFERRED);
+			assert(map->heap->isEmpty());
+
+			node = node->next;
+			num_deferred++;
+		}
+
 		SubHeapInstance * instance = _unused_subheaps;
 		while (instance != NULL) {
 			instance = instance->next_unused;
@@ -247,7 +334,7 @@ public:
 		}
 
 		assert(num_unused_instances == num_unused_partitions);
-		assert(num_avai + num_full + num_unused_partitions == NumPartitions);
+		assert(num_avai + num_full + num_deferred + num_unused_partitions == NumPartitions);
 #endif
 #endif
 	}
@@ -258,7 +345,9 @@ private:
 		NumPartitions = (1UL << 31) / PartitionSize << 1,
 		SUBHEAP_FULL = 1,
 		SUBHEAP_AVAI = 2,
+		SUBHEAP_DEFERRED = 3,
 		INVALID_TYPE = 0xFF,
+		RESIDENCY_CHUNK = 256,
 	};
 
 	struct SubHeapList {
@@ -282,6 +371,10 @@ private:
 	SubHeapMap _subheap_map[NumPartitions];
 	SubHeapInstance _subheap_pool[NumPartitions];
 	SubHeapInstance * _unused_subheaps;
+	size_t _num_purged;
+	size_t _num_released;
+	size_t _num_visitors;			// visits of the partitions going on
+	list_head _deferred_list;		// empty subheaps kept from being destroyed during visits
 
 	inline size_t ptrToPartition(void * ptr) {
 		return reinterpret_cast<size_t>(ptr) / PartitionSize;
@@ -295,6 +388,53 @@ private:
 		return &_subheap_map[ptrToPartition(ptr)];
 	}
 
+	// take a partition out of the type map, unless a visitor may have started walking it; a visitor counts itself
+	// before it reads the type map, so with a barrier in between either it sees the partition gone or we see it
+	inline bool hidePartition(size_t partition) {
+		unsigned char type = _type_map[partition];
+		_type_map[partition] = INVALID_TYPE;
+		__sync_synchronize();
+		if (_num_visitors == 0)
+			return true;
+
+		_type_map[partition] = type;
+		return false;
+	}
+
+	// destroy an empty subheap, whose partition is already out of the type map
+	void releaseSubHeap(SubHeapMap * map) {
+		list_del(&map->list);
+
+		void * heap_address = map->heap->getHeapAddress();
+		assert(heap_address != NULL);
+		assert(map == ptrToMap(heap_address));
+		assert(_type_map[ptrToPartition(heap_address)] == INVALID_TYPE);
+
+		map->heap->~SubHeap();
+
+		SubHeapInstance * instance = container_of(reinterpret_cast<const char (*) [sizeof(SubHeap)]>(map->heap), SubHeapInstance, space);
+
+//		SubHeapInstance * instance = reinterpret_cast<SubHeapInstance *>(reinterpret_cast<size_t>(map->heap) - reinterpret_cast<size_t>(&reinterpret_cast<SubHeapInstance *>(0)->space));
+
+		instance->next_unused = _unused_subheaps;
+		_unused_subheaps = instance;
+
+		memset(map, 0, sizeof(SubHeapMap));
+		__sync_fetch_and_add(&_num_released, 1);
+	}
+
+	// destroy the subheaps left empty during visits, unless another visit has started since
+	void releaseDeferred() {
+		list_head * node = _deferred_list.next;
+		while (node != &_deferred_list) {
+			SubHeapMap * map = list_entry(node, SubHeapMap, list);
+			node = node->next;
+
+			if (hidePartition(ptrToPartition(map->heap->getHeapAddress())))
+				releaseSubHeap(map);
+		}
+	}
+
 };	// end of class PartitionHeap
 
 // TheOnePartitionHeap: singleton of PartitionHeap
@@ -316,6 +456,37 @@ public:
 		_heap->free(ptr);
 	}
 
+	inline bool isKnownZero(void * ptr) {
+		return _heap->isKnownZero(ptr);
+	}
+
+	void getStats(size_t * partitions, size_t * clusters, size_t * discarded) {
+		_heap->getStats(partitions, clusters, discarded);
+	}
+
+	void getResidentPages(size_t * resident) {
+		_heap->getResidentPages(resident);
+	}
+
+	void getPurgeCounts(size_t * purged, size_t * released) {
+		_heap->getPurgeCounts(purged, released);
+	}
+
+	template<class Visitor>
+	void visitPartitions(Visitor & visitor) {
+		_heap->visitPartitions(visitor);
+	}
+
+	// subheaps keep their metadata at their start
+	enum {
+		OUT_OF_LINE_METADATA = 0,
+		METADATA_RATIO = 1,
+	};
+
+	inline void * getMetadata(void * subheap) {
+		return subheap;
+	}
+
 protected:
 
 	inline unsigned char ptrToType(void * ptr) {
@@ -0,0 +1,63 @@
+// -*- C++ -*-
+
+#ifndef _POPULARITY_H_
+#define _POPULARITY_H_
+
+#include "vamcommon.h"
+
+namespace VAM {
+
+// what FrequencyHeap knows about a size class when asking a popularity policy,
+// the counts lag behind by the allocations and frees that threads have not folded in yet
+struct PopularityStats {
+	size_t allocs;		// allocations, decayed at the end of each epoch
+	long live;			// live objects in dedicated subheaps
+};
+
+// a popularity policy decides when a size class gets dedicated subheaps and when it loses them again;
+// FrequencyHeap ends an epoch every EPOCH_LENGTH small allocations, decays the counts and checks for demotion
+
+// CumulativePopularity: a size class becomes popular for good once enough memory has been requested from it
+class CumulativePopularity {
+
+public:
+
+	enum {
+		EPOCH_LENGTH = 64 * 1024,
+	};
+
+	// sizes above a page also need a few allocations before they get a multi-page subheap
+	static inline bool promote(size_t size, const PopularityStats & stats) {
+		return size * stats.allocs > PAGE_SIZE && stats.allocs > 4;
+	}
+
+	static inline bool demote(size_t, const PopularityStats &) {
+		return false;
+	}
+
+	static inline size_t decay(size_t allocs) {
+		return allocs;
+	}
+
+};	// end of class CumulativePopularity
+
+// DecayingPopularity: halve the counts every epoch, so that sizes popular only in an earlier phase are demoted
+class DecayingPopularity : public CumulativePopularity {
+
+public:
+
+	// demote at a quarter of the promotion threshold to avoid flapping, and only once few objects are left,
+	// otherwise the holes in the subheaps would not be reused
+	static inline bool demote(size_t size, const PopularityStats & stats) {
+		return size * stats.allocs * 4 <= PAGE_SIZE && stats.live <= static_cast<long>(PAGE_SIZE / size);
+	}
+
+	static inline size_t decay(size_t allocs) {
+		return allocs / 2;
+	}
+
+};	// end of class DecayingPopularity
+
+};	// end of namespace VAM
+
+#endif
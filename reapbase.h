@@ -23,6 +23,27 @@ public:
 		return ptr;
 	}
 
+	// allocate up to n objects by pointer bumping and return the number allocated
+	inline size_t mallocBatch(void ** ptrs, size_t n) {
+		size_t num = _num_total - _num_bumped;
+		if (num > n)
+			num = n;
+
+		for (size_t i = 0; i < num; i++) {
+			ptrs[i] = reinterpret_cast<void *>(_bump_ptr);
+			_bump_ptr += _object_size;
+		}
+		_num_bumped += num;
+		_num_free -= num;
+
+		return num;
+	}
+
+	// will the next allocation come from bump space that is known to be zero?
+	inline bool nextIsZero() {
+		return _zeroed && _num_bumped < _num_total;
+	}
+
 	inline size_t getObjectSize() {
 		return _object_size;
 	}
@@ -35,6 +56,20 @@ public:
 		return _num_free;
 	}
 
+	inline void * getBasePtr() {
+		return reinterpret_cast<void *>(_base_ptr);
+	}
+
+	// objects are aligned to the largest power of two (up to a page) that divides their size
+	inline static size_t getAlignment(size_t object_size) {
+		size_t alignment = object_size & ~(object_size - 1);
+		if (alignment > PAGE_SIZE)
+			alignment = PAGE_SIZE;
+		if (alignment < sizeof(double))
+			alignment = sizeof(double);
+		return alignment;
+	}
+
 protected:
 
 	size_t _object_size;
@@ -42,19 +77,71 @@ protected:
 	size_t _num_free;
 	size_t _base_ptr;
 
-	inline void initReapBase(size_t object_size, size_t num_total, size_t num_free, size_t base_ptr) {
+	enum {
+		COLOR_SIZE = 64,	// a cache line
+	};
+
+	// the objects never allocated yet, all the others are either allocated or free in the map of a reap
+	inline size_t getNumUnbumped() {
+		return _num_total - _num_bumped;
+	}
+
+	inline static size_t alignBasePtr(size_t ptr, size_t object_size) {
+		size_t alignment = getAlignment(object_size);
+		return (ptr + alignment - 1) & ~(alignment - 1);
+	}
+
+	// shift the allocation base by a color, so that the first objects of subheaps do not all map to the same cache sets;
+	// colors only use the space left over after the last object, so they cost no objects, and stay within a page
+	inline static size_t colorBasePtr(size_t base_ptr, size_t end_ptr, size_t object_size, unsigned int color) {
+		size_t step = getAlignment(object_size);
+		if (step < COLOR_SIZE)
+			step = COLOR_SIZE;
+
+		size_t slack = (end_ptr - base_ptr) % object_size;
+		if (slack >= PAGE_SIZE)
+			slack = PAGE_SIZE - 1;
+
+		return base_ptr + color % (slack / step + 1) * step;
+	}
+
+	// divide an exact multiple of the object size by shifting and multiplying with the inverse of its odd part
+	inline size_t offsetToIndex(size_t offset) {
+		assert(offset % _object_size == 0);
+		return (offset >> _size_shift) * _size_inverse;
+	}
+
+	inline void initReapBase(size_t object_size, size_t num_total, size_t num_free, size_t base_ptr, bool zeroed) {
 		_object_size = object_size;
 		_num_total = num_total;
 		_num_free = num_free;
 		_base_ptr = base_ptr;
+		_zeroed = zeroed;
 
 		_num_bumped = 0;
 		_bump_ptr = base_ptr;
+
+		// object_size = odd * 2^_size_shift, and odd * _size_inverse = 1 modulo 2^SIZE_T_BIT
+		size_t odd = object_size;
+		_size_shift = 0;
+		while (!(odd & 1)) {
+			odd >>= 1;
+			_size_shift++;
+		}
+
+		// each Newton step doubles the number of correct low bits, starting from 3
+		_size_inverse = odd;
+		for (int i = 0; i < 5; i++)
+			_size_inverse *= 2 - odd * _size_inverse;
+		assert(odd * _size_inverse == 1);
 	}
 
 private:
 	size_t _num_bumped;
 	size_t _bump_ptr;
+	bool _zeroed;
+	size_t _size_shift;
+	size_t _size_inverse;
 
 };	// end of class ReapBase
 
@@ -0,0 +1,126 @@
+// -*- C++ -*-
+
+#ifndef _REGIONHEAP_H_
+#define _REGIONHEAP_H_
+
+#include "vamcommon.h"
+
+namespace VAM {
+
+// RegionHeap: a heap that allocates objects by pointer bumping in chunks of page clusters from SuperHeap,
+// chunks are released when all their objects have been freed or when the region is destroyed;
+// the partition type of a chunk is its type plus TypeOffset, so that chunks can have partitions of their own
+template<unsigned char ChunkType, unsigned char MaxChunkType, size_t PartitionSize, class SuperHeap, unsigned char TypeOffset = 0>
+class RegionHeap : public SuperHeap {
+
+public:
+
+	RegionHeap() : _current(NULL) {
+		INIT_LIST_HEAD(&_chunks);
+	}
+
+	// release all chunks at once, no matter how many objects are still allocated in them
+	~RegionHeap() {
+		while (!list_empty(&_chunks)) {
+			list_head * node = _chunks.next;
+			list_del(node);
+			SuperHeap::free(list_entry(node, Chunk, list));
+		}
+	}
+
+	inline void * malloc(size_t size) {
+		assert(size % sizeof(double) == 0);
+
+		if (_current != NULL && size <= _current->end - _current->bump) {
+			void * ptr = reinterpret_cast<void *>(_current->bump);
+			_current->bump += size;
+			_current->live++;
+			return ptr;
+		}
+
+		return allocateChunk(size);
+	}
+
+	// freeing is optional, it only lets a chunk go before the region is destroyed
+	inline void free(void * ptr) {
+		Chunk * chunk = ptrToChunk(ptr);
+		assert(chunk->live > 0);
+
+		if (--chunk->live == 0 && chunk != _current)
+			releaseChunk(chunk);
+	}
+
+private:
+
+	struct Chunk {
+		list_head list;
+		size_t bump;
+		size_t end;
+		size_t live;		// number of objects not freed yet
+	};
+
+	Chunk * _current;
+	list_head _chunks;
+
+	// allocate the object in a new chunk, big enough for it
+	void * allocateChunk(size_t size) {
+		unsigned char type = ChunkType;
+		size_t chunk_size = PAGE_SIZE << (ChunkType - 1);
+		while (type < MaxChunkType && chunk_size < sizeof(Chunk) + size) {
+			type++;
+			chunk_size <<= 1;
+		}
+
+		// objects too large for any chunk type get a huge chunk of their own, the way TwoHeap allocates them
+		unsigned char partition_type = type + TypeOffset;
+		if (chunk_size < sizeof(Chunk) + size) {
+			type = partition_type = USE_HEADER_TYPE;
+			chunk_size = (sizeof(Chunk) + size + PAGE_SIZE - 1) & PAGE_MASK;
+			if (chunk_size <= PartitionSize)
+				chunk_size = PartitionSize + PAGE_SIZE;
+		}
+
+		Chunk * chunk = reinterpret_cast<Chunk *>(SuperHeap::malloc(chunk_size, partition_type));
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->bump = reinterpret_cast<size_t>(chunk + 1);
+		chunk->end = reinterpret_cast<size_t>(chunk) + chunk_size;
+		chunk->live = 1;
+		list_add(&chunk->list, &_chunks);
+
+		void * ptr = reinterpret_cast<void *>(chunk->bump);
+		chunk->bump += size;
+
+		// keep bumping in the chunk with more room left, huge chunks only ever hold their one object
+		if (type != USE_HEADER_TYPE && (_current == NULL || chunk->end - chunk->bump > _current->end - _current->bump)) {
+			Chunk * old = _current;
+			_current = chunk;
+			if (old != NULL && old->live == 0)
+				releaseChunk(old);
+		}
+
+		return ptr;
+	}
+
+	inline void releaseChunk(Chunk * chunk) {
+		assert(chunk != _current);
+		list_del(&chunk->list);
+		SuperHeap::free(chunk);
+	}
+
+	// find the chunk from an object, chunks are aligned to their size except huge ones that start right before their object
+	inline Chunk * ptrToChunk(void * ptr) {
+		unsigned char type = SuperHeap::ptrToType(ptr);
+		if (type == USE_HEADER_TYPE)
+			return reinterpret_cast<Chunk *>(ptr) - 1;
+
+		type -= TypeOffset;
+		return reinterpret_cast<Chunk *>(reinterpret_cast<size_t>(ptr) & (PAGE_MASK << (type - 1)));
+	}
+
+};	// end of class RegionHeap
+
+};	// end of namespace VAM
+
+#endif
@@ -4,6 +4,7 @@
 #define _SEGFITHEAP_H_
 
 #include "objectheader.h"
+#include "latencyhistogram.h"
 
 namespace VAM {
 
@@ -103,6 +104,7 @@ public:
 		// then try to find a first fit in the freelist for large sizes
 		if (ptr == NULL) {
 			if (!list_empty(&_large_size_list)) {
+				LatencyTimer timer(LATENCY_LARGE_SCAN);
 				node = _large_size_list.next;
 				while (node != &_large_size_list) {
 					if (ObjectHeader::getHeader(node)->_size >= size) {
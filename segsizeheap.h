@@ -5,27 +5,72 @@
 
 namespace VAM {
 
-// SegSizeHeap: a heap that segregates objects based on their sizes
-template<size_t MaxObjectSize, class SuperHeap>
+// SegSizeHeap: a heap that segregates objects into the size classes given by SizeClasses
+template<class SizeClasses, class SuperHeap>
 class SegSizeHeap : public SuperHeap {
 
 public:
 
 	inline void * malloc(size_t size) {
-		assert(size <= MaxObjectSize);
+		assert(size <= SizeClasses::MAX_SIZE);
 
-		return _subheap[SIZE_TO_INDEX(size)].malloc(size);
+		size_t index = SizeClasses::sizeToIndex(size);
+		return _subheap[index].malloc(SizeClasses::indexToSize(index));
+	}
+
+	inline void * calloc(size_t size) {
+		assert(size <= SizeClasses::MAX_SIZE);
+
+		size_t index = SizeClasses::sizeToIndex(size);
+		return _subheap[index].calloc(SizeClasses::indexToSize(index));
 	}
 
 	inline void free(void * ptr) {
 		size_t size = SuperHeap::getSize(ptr);
-		assert(size <= MaxObjectSize);
-		_subheap[SIZE_TO_INDEX(size)].free(ptr);
+		assert(size <= SizeClasses::MAX_SIZE);
+		_subheap[SizeClasses::sizeToIndex(size)].free(ptr);
+	}
+
+	// free with the size supplied by the caller, avoiding the lookup in the subheap header
+	inline void free(void * ptr, size_t size) {
+		assert(size <= SizeClasses::MAX_SIZE);
+		assert(SizeClasses::sizeToIndex(size) == SizeClasses::sizeToIndex(SuperHeap::getSize(ptr)));
+		_subheap[SizeClasses::sizeToIndex(size)].free(ptr);
+	}
+
+	// the size of the objects actually allocated for the requested size
+	inline size_t getRoundedSize(size_t size) {
+		assert(size <= SizeClasses::MAX_SIZE);
+
+		return SizeClasses::indexToSize(SizeClasses::sizeToIndex(size));
+	}
+
+	inline size_t mallocBatch(size_t size, void ** ptrs, size_t n) {
+		assert(size <= SizeClasses::MAX_SIZE);
+
+		size_t index = SizeClasses::sizeToIndex(size);
+		return _subheap[index].mallocBatch(SizeClasses::indexToSize(index), ptrs, n);
+	}
+
+	// free n objects of the same size
+	inline void freeBatch(void ** ptrs, size_t n) {
+		size_t size = SuperHeap::getSize(ptrs[0]);
+		assert(size <= SizeClasses::MAX_SIZE);
+		_subheap[SizeClasses::sizeToIndex(size)].freeBatch(ptrs, n);
+	}
+
+	// how often the subheaps of a size class come and go
+	inline const ChurnStats & getChurnStats(size_t index) {
+		return _subheap[index].getChurnStats();
+	}
+
+	inline void releaseIdleSpare(size_t index) {
+		_subheap[index].releaseIdleSpare();
 	}
 
 private:
 
-	SuperHeap _subheap[SIZE_TO_INDEX(MaxObjectSize) + 1];
+	SuperHeap _subheap[SizeClasses::NUM_CLASSES];
 
 };	// end of class SegSizeHeap
 
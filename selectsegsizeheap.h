@@ -0,0 +1,127 @@
+// -*- C++ -*-
+
+#ifndef _SELECTSEGSIZEHEAP_H_
+#define _SELECTSEGSIZEHEAP_H_
+
+namespace VAM {
+
+// UpToSize: a selector of SelectSegSizeHeap that picks its first heap for the size classes up to MaxSize
+template<size_t MaxSize>
+class UpToSize {
+
+public:
+
+	inline static bool useFirst(size_t size) {
+		return size <= MaxSize;
+	}
+
+};	// end of class UpToSize
+
+// SelectSegSizeHeap: a SegSizeHeap whose size classes each use SuperHeap1 or SuperHeap2, as Selector::useFirst(size) says,
+// so that size classes can differ in how they reuse freed objects; the sizes of objects are looked up through SuperHeap1,
+// which works for any two OneSizeHeaps, as all reaps start with their ReapBase
+template<class SizeClasses, class Selector, class SuperHeap1, class SuperHeap2>
+class SelectSegSizeHeap : public SuperHeap1 {
+
+public:
+
+	SelectSegSizeHeap() {
+		for (size_t index = 0; index < SizeClasses::NUM_CLASSES; index++)
+			_use_first[index] = Selector::useFirst(SizeClasses::indexToSize(index));
+	}
+
+	inline void * malloc(size_t size) {
+		assert(size <= SizeClasses::MAX_SIZE);
+
+		size_t index = SizeClasses::sizeToIndex(size);
+		if (_use_first[index])
+			return _subheap1[index].malloc(SizeClasses::indexToSize(index));
+		else
+			return _subheap2[index].malloc(SizeClasses::indexToSize(index));
+	}
+
+	inline void * calloc(size_t size) {
+		assert(size <= SizeClasses::MAX_SIZE);
+
+		size_t index = SizeClasses::sizeToIndex(size);
+		if (_use_first[index])
+			return _subheap1[index].calloc(SizeClasses::indexToSize(index));
+		else
+			return _subheap2[index].calloc(SizeClasses::indexToSize(index));
+	}
+
+	inline void free(void * ptr) {
+		size_t size = SuperHeap1::getSize(ptr);
+		assert(size <= SizeClasses::MAX_SIZE);
+		freeIndex(SizeClasses::sizeToIndex(size), ptr);
+	}
+
+	// free with the size supplied by the caller, avoiding the lookup in the subheap header
+	inline void free(void * ptr, size_t size) {
+		assert(size <= SizeClasses::MAX_SIZE);
+		assert(SizeClasses::sizeToIndex(size) == SizeClasses::sizeToIndex(SuperHeap1::getSize(ptr)));
+		freeIndex(SizeClasses::sizeToIndex(size), ptr);
+	}
+
+	// the size of the objects actually allocated for the requested size
+	inline size_t getRoundedSize(size_t size) {
+		assert(size <= SizeClasses::MAX_SIZE);
+
+		return SizeClasses::indexToSize(SizeClasses::sizeToIndex(size));
+	}
+
+	inline size_t mallocBatch(size_t size, void ** ptrs, size_t n) {
+		assert(size <= SizeClasses::MAX_SIZE);
+
+		size_t index = SizeClasses::sizeToIndex(size);
+		if (_use_first[index])
+			return _subheap1[index].mallocBatch(SizeClasses::indexToSize(index), ptrs, n);
+		else
+			return _subheap2[index].mallocBatch(SizeClasses::indexToSize(index), ptrs, n);
+	}
+
+	// free n objects of the same size
+	inline void freeBatch(void ** ptrs, size_t n) {
+		size_t size = SuperHeap1::getSize(ptrs[0]);
+		assert(size <= SizeClasses::MAX_SIZE);
+
+		size_t index = SizeClasses::sizeToIndex(size);
+		if (_use_first[index])
+			_subheap1[index].freeBatch(ptrs, n);
+		else
+			_subheap2[index].freeBatch(ptrs, n);
+	}
+
+	// how often the subheaps of a size class come and go
+	inline const ChurnStats & getChurnStats(size_t index) {
+		if (_use_first[index])
+			return _subheap1[index].getChurnStats();
+		else
+			return _subheap2[index].getChurnStats();
+	}
+
+	inline void releaseIdleSpare(size_t index) {
+		if (_use_first[index])
+			_subheap1[index].releaseIdleSpare();
+		else
+			_subheap2[index].releaseIdleSpare();
+	}
+
+private:
+
+	bool _use_first[SizeClasses::NUM_CLASSES];
+	SuperHeap1 _subheap1[SizeClasses::NUM_CLASSES];
+	SuperHeap2 _subheap2[SizeClasses::NUM_CLASSES];
+
+	inline void freeIndex(size_t index, void * ptr) {
+		if (_use_first[index])
+			_subheap1[index].free(ptr);
+		else
+			_subheap2[index].free(ptr);
+	}
+
+};	// end of class SelectSegSizeHeap
+
+};	// end of namespace VAM
+
+#endif
@@ -0,0 +1,78 @@
+// -*- C++ -*-
+
+#ifndef _SERIALIZEDHEAP_H_
+#define _SERIALIZEDHEAP_H_
+
+#include "vamcommon.h"
+
+namespace VAM {
+
+// SerializedHeap: a heap that serializes all operations on SuperHeap with one lock
+template<class LockType, class SuperHeap>
+class SerializedHeap : public SuperHeap {
+
+public:
+
+	inline void * malloc(size_t size) {
+		_lock.lock();
+		void * ptr = SuperHeap::malloc(size);
+		_lock.unlock();
+		return ptr;
+	}
+
+	inline void free(void * ptr) {
+		_lock.lock();
+		SuperHeap::free(ptr);
+		_lock.unlock();
+	}
+
+	inline void * calloc(size_t size) {
+		_lock.lock();
+		void * ptr = SuperHeap::calloc(size);
+		_lock.unlock();
+		return ptr;
+	}
+
+	inline void * memalign(size_t alignment, size_t size) {
+		_lock.lock();
+		void * ptr = SuperHeap::memalign(alignment, size);
+		_lock.unlock();
+		return ptr;
+	}
+
+	inline bool resize(void * ptr, size_t size) {
+		_lock.lock();
+		bool resized = SuperHeap::resize(ptr, size);
+		_lock.unlock();
+		return resized;
+	}
+
+	inline void releaseIdleSpare() {
+		_lock.lock();
+		SuperHeap::releaseIdleSpare();
+		_lock.unlock();
+	}
+
+	// the whole batch is done while holding the lock once
+	inline size_t mallocBatch(size_t size, void ** ptrs, size_t n) {
+		_lock.lock();
+		size_t num = SuperHeap::mallocBatch(size, ptrs, n);
+		_lock.unlock();
+		return num;
+	}
+
+	inline void freeBatch(void ** ptrs, size_t n) {
+		_lock.lock();
+		SuperHeap::freeBatch(ptrs, n);
+		_lock.unlock();
+	}
+
+private:
+
+	LockType _lock;
+
+};	// end of class SerializedHeap
+
+};	// end of namespace VAM
+
+#endif
@@ -0,0 +1,72 @@
+// -*- C++ -*-
+
+#ifndef _SIDEMETADATAHEAP_H_
+#define _SIDEMETADATAHEAP_H_
+
+#include "vamcommon.h"
+
+#include "alignedmmapheap.h"
+
+namespace VAM {
+
+// SideMetadataHeap: a source of subheaps whose metadata live out of line, in a dense side table per partition
+// indexed by the subheap number within the partition, so that objects start right at the subheap base;
+// the first page of a subheap is then no longer written by every allocation and free, and the headers of
+// many subheaps no longer alias in the same cache sets because of their aligned addresses;
+// each subheap gets 1/MetadataRatio of its size for its header and map, which must be enough for the reap
+template<size_t MetadataRatio, size_t PartitionSize, class SuperHeap>
+class SideMetadataHeap : public SuperHeap {
+
+public:
+
+	enum {
+		OUT_OF_LINE_METADATA = 1,
+		METADATA_RATIO = MetadataRatio,
+	};
+
+	inline void * malloc(size_t size, unsigned char type = 0) {
+		void * ptr = SuperHeap::malloc(size, type);
+		if (ptr != NULL && size <= PartitionSize && _tables[ptrToPartition(ptr)] == 0)
+			createTable(ptr);
+		return ptr;
+	}
+
+	// the metadata slot of the subheap starting at the given address
+	inline void * getMetadata(void * subheap) {
+		size_t offset = reinterpret_cast<size_t>(subheap) % PartitionSize;
+		return reinterpret_cast<void *>(_tables[ptrToPartition(subheap)] + offset / MetadataRatio);
+	}
+
+private:
+
+	enum {
+		NumPartitions = (1UL << 31) / PartitionSize << 1,
+		TABLE_SIZE = PartitionSize / MetadataRatio,
+	};
+
+	// shared by all heaps, tables are never released since the partitions are not either
+	static size_t _tables[NumPartitions];
+
+	inline static size_t ptrToPartition(void * ptr) {
+		return reinterpret_cast<size_t>(ptr) / PartitionSize;
+	}
+
+	// only the slots in use get touched, so a table costs little more than the metadata it holds
+	void createTable(void * ptr) {
+		TheOneAlignedMmapHeap mmap_heap;
+		size_t table = reinterpret_cast<size_t>(mmap_heap.malloc(TABLE_SIZE));
+		abort_on(table == 0);
+
+		// another thread may have created the table of the partition meanwhile
+		if (!__sync_bool_compare_and_swap(&_tables[ptrToPartition(ptr)], 0, table))
+			mmap_heap.free(reinterpret_cast<void *>(table));
+	}
+
+};	// end of class SideMetadataHeap
+
+template<size_t MetadataRatio, size_t PartitionSize, class SuperHeap>
+size_t SideMetadataHeap<MetadataRatio, PartitionSize, SuperHeap>::_tables[NumPartitions];
+
+};	// end of namespace VAM
+
+#endif
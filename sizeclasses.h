@@ -0,0 +1,93 @@
+// -*- C++ -*-
+
+#ifndef _SIZECLASSES_H_
+#define _SIZECLASSES_H_
+
+#include "vamcommon.h"
+
+namespace VAM {
+
+// LinearSizeClasses: one size class every sizeof(double) bytes up to MaxSize
+template<size_t MaxSize>
+class LinearSizeClasses {
+
+public:
+
+	enum {
+		MAX_SIZE = MaxSize,
+		NUM_CLASSES = SIZE_TO_INDEX(MaxSize) + 1,
+	};
+
+	static inline size_t sizeToIndex(size_t size) {
+		assert(size > 0 && size <= MaxSize);
+		return SIZE_TO_INDEX(size);
+	}
+
+	static inline size_t indexToSize(size_t index) {
+		assert(index < NUM_CLASSES);
+		return INDEX_TO_SIZE(index);
+	}
+
+};	// end of class LinearSizeClasses
+
+// GeometricSizeClasses: linear classes up to LinearSize (a power of two of at least 32), then four classes per power of two,
+// bounding the internal fragmentation to 25% with far fewer classes (and subheaps) than LinearSizeClasses
+template<size_t MaxSize, size_t LinearSize = 64>
+class GeometricSizeClasses {
+
+	// the number of the highest set bit of n
+	template<size_t n, int dummy = 0>
+	struct Log2 {
+		enum { VALUE = 1 + Log2<n / 2>::VALUE };
+	};
+
+	template<int dummy>
+	struct Log2<1, dummy> {
+		enum { VALUE = 0 };
+	};
+
+	enum {
+		LINEAR_SHIFT = Log2<LinearSize>::VALUE,
+		LINEAR_SIZE = LinearSize,
+		LINEAR_CLASSES = LinearSize / sizeof(double),
+		STEPS_SHIFT = 2,
+		STEPS = 1 << STEPS_SHIFT,
+	};
+
+public:
+
+	enum {
+		MAX_SIZE = MaxSize,
+		NUM_CLASSES = LINEAR_CLASSES + (Log2<MaxSize - 1>::VALUE + 1 - LINEAR_SHIFT) * STEPS,
+	};
+
+	static inline size_t sizeToIndex(size_t size) {
+		assert(size > 0 && size <= MaxSize);
+
+		if (size <= LINEAR_SIZE)
+			return SIZE_TO_INDEX(size);
+
+		// size - 1 lies in [2^order, 2^(order + 1)), which is split into STEPS classes
+		size_t order = SIZE_T_BIT - 1 - __builtin_clzl(size - 1);
+		size_t step_shift = order - STEPS_SHIFT;
+
+		return LINEAR_CLASSES + (order - LINEAR_SHIFT) * STEPS + ((size - 1) >> step_shift) - STEPS;
+	}
+
+	static inline size_t indexToSize(size_t index) {
+		assert(index < NUM_CLASSES);
+
+		if (index < LINEAR_CLASSES)
+			return INDEX_TO_SIZE(index);
+
+		size_t order = LINEAR_SHIFT + (index - LINEAR_CLASSES) / STEPS;
+		size_t step = (index - LINEAR_CLASSES) % STEPS + 1;
+
+		return (1UL << order) + (step << (order - STEPS_SHIFT));
+	}
+
+};	// end of class GeometricSizeClasses
+
+};	// end of namespace VAM
+
+#endif
@@ -14,8 +14,149 @@ class SplitCoalesceHeap : public SuperHeap1, public SuperHeap2 {
 public:
 
 	inline void * malloc(size_t size) {
+		bool zero;
+		return allocate(size, zero);
+	}
+
+	// allocate a zeroed object, clearing it only if it has been used before
+	inline void * calloc(size_t size) {
+		bool zero;
+		void * ptr = allocate(size, zero);
+		if (ptr != NULL && !zero)
+			memset(ptr, 0, size);
+		return ptr;
+	}
+
+	inline void free(void * ptr) {
+		ObjectHeader * header = ObjectHeader::getHeader(ptr);
+		assert(!header->isFree());
+
+		list_head * node;
+
+		assert(header->getPrevHeader()->getNextHeader() == header);
+		assert(header->getNextHeader()->getPrevHeader() == header);
+
+		header->setFree(1);
+
+		// check if we can coalesce with the previous object
+		if (header->_prev_free) {
+			ObjectHeader * prev_header = header->getPrevHeader();
+			SuperHeap1::remove(prev_header->getObject());
+
+			coalesce(prev_header, header);
+			header = prev_header;
+		}
+
+		// check if we can coalesce with the next object
+		if (header->getNextHeader()->isFree()) {
+			ObjectHeader * next_header = header->getNextHeader();
+			SuperHeap1::remove(next_header->getObject());
+
+			coalesce(header, next_header);
+		}
+
+		SuperHeap1::free(header->getObject());
+	}
+
+	// resize an object in place, growing into the next object if it is free and shrinking by splitting
+	inline bool resize(void * ptr, size_t size) {
+		ObjectHeader * header = ObjectHeader::getHeader(ptr);
+		assert(!header->isFree());
+		assert(header->getPrevHeader()->getNextHeader() == header);
+		assert(header->getNextHeader()->getPrevHeader() == header);
+
+		if (size > header->_size) {
+			ObjectHeader * next_header = header->getNextHeader();
+			if (!next_header->isFree() || header->_size + sizeof(ObjectHeader) + next_header->_size < size)
+				return false;
+
+			// absorb the next object
+			SuperHeap1::remove(next_header->getObject());
+
+			size_t new_size = header->_size + sizeof(ObjectHeader) + next_header->_size;
+			header->_size = new_size;
+			header->getNextHeader()->_prev_size = new_size;
+			header->setFree(0);
+		}
+
+		// give back the tail if it is big enough
+		ObjectHeader * split_piece_header = split(header, size);
+		if (split_piece_header != NULL) {
+			assert(split_piece_header->isFree());
+
+			// the tail may be followed by a free object when shrinking
+			if (split_piece_header->getNextHeader()->isFree()) {
+				ObjectHeader * next_header = split_piece_header->getNextHeader();
+				SuperHeap1::remove(next_header->getObject());
+
+				coalesce(split_piece_header, next_header);
+			}
+
+			SuperHeap1::free(split_piece_header->getObject());
+		}
+
+		assert(header->getNextHeader()->getPrevHeader() == header);
+		assert(!header->isFree());
+		assert(header->_size >= size);
+
+		return true;
+	}
+
+	// allocate an aligned object by splitting off a leading piece that is freed again
+	inline void * memalign(size_t alignment, size_t size) {
+		assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+		if (alignment <= sizeof(double))
+			return malloc(size);
+
+		// leave room for an aligned object behind a leading piece that can be freed on its own
+		void * ptr = malloc(size + alignment + MIN_PIECE_SIZE);
+		if (ptr == NULL)
+			return NULL;
+
+		size_t start = reinterpret_cast<size_t>(ptr);
+		size_t aligned = (start + alignment - 1) & ~(alignment - 1);
+		if (aligned == start)
+			return ptr;
+		while (aligned - start < MIN_PIECE_SIZE)
+			aligned += alignment;
+
+		// the header of the aligned object takes the tail of the leading piece
+		ObjectHeader * header = ObjectHeader::getHeader(ptr);
+		ObjectHeader * aligned_header = ObjectHeader::getHeader(reinterpret_cast<void *>(aligned));
+		assert(header->_size >= aligned - start + size);
+
+		aligned_header->_size = header->_size - (aligned - start);
+		aligned_header->_prev_size = aligned - start - sizeof(ObjectHeader);
+		aligned_header->_prev_free = 0;
+		aligned_header->getNextHeader()->_prev_size = aligned_header->_size;
+		header->_size = aligned_header->_prev_size;
+
+		assert(header->getNextHeader() == aligned_header);
+		assert(aligned_header->getPrevHeader() == header);
+		assert(!aligned_header->isFree());
+
+		free(ptr);
+
+		return reinterpret_cast<void *>(aligned);
+	}
+
+	inline size_t getSize(void * ptr) {
+		return ObjectHeader::getHeader(ptr)->_size;
+	}
+
+protected:
+	enum {
+		MAX_OBJECT_SIZE = SuperChunkSize - 4 * sizeof(ObjectHeader),
+		MIN_PIECE_SIZE = sizeof(ObjectHeader) + sizeof(list_head),
+	};
+
+private:
+
+	// allocate an object and tell whether its memory is known to be zero
+	inline void * allocate(size_t size, bool & zero) {
 		void * ptr = SuperHeap1::malloc(size);
 		ObjectHeader * header;
+		zero = false;
 
 		if (ptr != NULL) {
 			header = ObjectHeader::getHeader(ptr);
@@ -23,6 +164,9 @@ public:
 		else {
 			header = reinterpret_cast<ObjectHeader *>(SuperHeap2::malloc(SuperChunkSize));
 			if (header != NULL) {
+				// the first object in a discarded chunk is untouched, only headers are written around it
+				zero = SuperHeap2::isKnownZero(header);
+
 				// set headers, 2 at the beginning and 2 at the end
 
 				// the first header is for an empty object
@@ -72,48 +216,6 @@ public:
 		return ptr;
 	}
 
-	inline void free(void * ptr) {
-		ObjectHeader * header = ObjectHeader::getHeader(ptr);
-		assert(!header->isFree());
-
-		list_head * node;
-
-		assert(header->getPrevHeader()->getNextHeader() == header);
-		assert(header->getNextHeader()->getPrevHeader() == header);
-
-		header->setFree(1);
-
-		// check if we can coalesce with the previous object
-		if (header->_prev_free) {
-			ObjectHeader * prev_header = header->getPrevHeader();
-			SuperHeap1::remove(prev_header->getObject());
-
-			coalesce(prev_header, header);
-			header = prev_header;
-		}
-
-		// check if we can coalesce with the next object
-		if (header->getNextHeader()->isFree()) {
-			ObjectHeader * next_header = header->getNextHeader();
-			SuperHeap1::remove(next_header->getObject());
-
-			coalesce(header, next_header);
-		}
-
-		SuperHeap1::free(header->getObject());
-	}
-
-	inline size_t getSize(void * ptr) {
-		return ObjectHeader::getHeader(ptr)->_size;
-	}
-
-protected:
-	enum {
-		MAX_OBJECT_SIZE = SuperChunkSize - 4 * sizeof(ObjectHeader),
-	};
-
-private:
-
 	// split an object just allocated in order to reuse the remainder
 	inline static ObjectHeader * split(ObjectHeader * header, size_t requested_size) {
 		size_t actual_size = header->_size;
@@ -0,0 +1,182 @@
+// -*- C++ -*-
+
+#ifndef _THREADCACHINGHEAP_H_
+#define _THREADCACHINGHEAP_H_
+
+#include <pthread.h>
+
+#include "vamcommon.h"
+#include "sizeclasses.h"
+
+namespace VAM {
+
+// ThreadCachingHeap: a heap that keeps per-thread caches of freed objects for each size class and flushes them at thread exit
+template<class SizeClasses, class SuperHeap>
+class ThreadCachingHeap : public SuperHeap {
+
+public:
+
+	ThreadCachingHeap() {
+		// the key destructor returns the caches of an exiting thread to SuperHeap, one key serves all instances
+		pthread_once(&_exit_key_once, createExitKey);
+	}
+
+	inline void * malloc(size_t size) {
+		assert(size <= SizeClasses::MAX_SIZE);
+		size_t index = SizeClasses::sizeToIndex(size);
+
+		// allocate from the cache of this thread
+		CachedObject * obj = _cached_objects[index];
+		if (obj != NULL) {
+			assert(_num_cached[index] > 0);
+			_cached_objects[index] = obj->next;
+			_num_cached[index]--;
+			return obj;
+		}
+
+		return SuperHeap::malloc(size);
+	}
+
+	// cached objects have been used and need clearing, others may come from fresh memory
+	inline void * calloc(size_t size) {
+		assert(size <= SizeClasses::MAX_SIZE);
+
+		if (_cached_objects[SizeClasses::sizeToIndex(size)] != NULL) {
+			void * ptr = malloc(size);
+			memset(ptr, 0, size);
+			return ptr;
+		}
+
+		return SuperHeap::calloc(size);
+	}
+
+	inline void free(void * ptr) {
+		free(ptr, SuperHeap::getSize(ptr));
+	}
+
+	inline void free(void * ptr, size_t size) {
+		assert(size <= SizeClasses::MAX_SIZE);
+		size_t index = SizeClasses::sizeToIndex(size);
+
+		// make sure we get a chance to flush the caches when this thread exits
+		if (!_registered)
+			registerThread();
+
+		// free to the cache of this thread, which holds fewer objects of the larger sizes
+		if (_num_cached[index] < MAX_CACHE_SIZE && (_num_cached[index] + 1) * size <= MAX_CACHE_BYTES) {
+			CachedObject * obj = reinterpret_cast<CachedObject *>(ptr);
+			obj->next = _cached_objects[index];
+			_cached_objects[index] = obj;
+			_num_cached[index]++;
+		}
+		// the cache is full, give half of it back
+		else {
+			SuperHeap::free(ptr, size);
+			flush(index, _num_cached[index] / 2);
+		}
+	}
+
+	// free straight to SuperHeap, for size classes that are no longer popular and whose cached objects would never
+	// be allocated again; those this thread still caches for the class go back as well
+	inline void freeUncached(void * ptr, size_t size) {
+		assert(size <= SizeClasses::MAX_SIZE);
+		flush(SizeClasses::sizeToIndex(size), 0);
+		SuperHeap::free(ptr, size);
+	}
+
+	// return the objects cached by this thread for one size class to SuperHeap
+	inline void flushCache(size_t index) {
+		flush(index, 0);
+	}
+
+	// return all objects cached by this thread to SuperHeap
+	void flushThreadCache() {
+		for (size_t index = 0; index < NUM_SIZES; index++) {
+			flush(index, 0);
+		}
+	}
+
+private:
+
+	enum {
+		NUM_SIZES = SizeClasses::NUM_CLASSES,
+		MAX_CACHE_SIZE = 32,
+		MAX_CACHE_BYTES = 32 * 1024,
+	};
+
+	struct CachedObject {
+		CachedObject * next;
+	};
+
+	static pthread_key_t _exit_key;
+	static pthread_once_t _exit_key_once;
+
+	static __thread CachedObject * _cached_objects[NUM_SIZES];
+	static __thread unsigned int _num_cached[NUM_SIZES];
+	static __thread bool _registered;
+
+	inline void registerThread() {
+		// set the flag first, pthread_setspecific() may call malloc()
+		_registered = true;
+		pthread_setspecific(_exit_key, this);
+	}
+
+	// shrink the cache of the given size to the target number of objects
+	inline void flush(size_t index, unsigned int target) {
+		while (_num_cached[index] > target) {
+			CachedObject * obj = _cached_objects[index];
+			assert(obj != NULL);
+
+			_cached_objects[index] = obj->next;
+			_num_cached[index]--;
+
+			SuperHeap::free(obj, SizeClasses::indexToSize(index));
+		}
+		assert(target > 0 || _cached_objects[index] == NULL);
+	}
+
+	static void createExitKey() {
+		int rc = pthread_key_create(&_exit_key, flushOnExit);
+		abort_on(rc != 0);
+	}
+
+	static void flushOnExit(void * heap) {
+		// the objects go back to their subheaps, which then become available to other threads or are released when empty
+		_registered = false;
+		reinterpret_cast<ThreadCachingHeap *>(heap)->flushThreadCache();
+	}
+
+};	// end of class ThreadCachingHeap
+
+template<class SizeClasses, class SuperHeap>
+pthread_key_t ThreadCachingHeap<SizeClasses, SuperHeap>::_exit_key;
+
+template<class SizeClasses, class SuperHeap>
+pthread_once_t ThreadCachingHeap<SizeClasses, SuperHeap>::_exit_key_once = PTHREAD_ONCE_INIT;
+
+template<class SizeClasses, class SuperHeap>
+__thread typename ThreadCachingHeap<SizeClasses, SuperHeap>::CachedObject * ThreadCachingHeap<SizeClasses, SuperHeap>::_cached_objects[NUM_SIZES];
+
+template<class SizeClasses, class SuperHeap>
+__thread unsigned int ThreadCachingHeap<SizeClasses, SuperHeap>::_num_cached[NUM_SIZES];
+
+template<class SizeClasses, class SuperHeap>
+__thread bool ThreadCachingHeap<SizeClasses, SuperHeap>::_registered;
+
+// UncachedHeap: the interface of ThreadCachingHeap without the caches, for builds that are not thread-safe
+template<class SuperHeap>
+class UncachedHeap : public SuperHeap {
+
+public:
+
+	inline void freeUncached(void * ptr, size_t size) {
+		SuperHeap::free(ptr, size);
+	}
+
+	inline void flushCache(size_t) {}
+
+};	// end of class UncachedHeap
+
+};	// end of namespace VAM
+
+#endif
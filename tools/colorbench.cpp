@@ -0,0 +1,52 @@
+// measure how fast the first cache lines of many same-size objects spread over many subheaps can be walked,
+// run it with LD_PRELOAD set to a libvam built with and without -DNO_CACHE_COLORING to see what coloring buys
+//
+// usage: colorbench [object size] [number of objects] [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char * argv[]) {
+	size_t size = argc > 1 ? atol(argv[1]) : 1000;
+	size_t count = argc > 2 ? atol(argv[2]) : 4096;
+	int rounds = argc > 3 ? atoi(argv[3]) : 1000;
+
+	if (size < sizeof(size_t) || count == 0 || rounds <= 0) {
+		fprintf(stderr, "usage: %s [object size] [number of objects] [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	// enough objects fill many subheaps, whose first objects all start at the same page offset without coloring
+	size_t ** objects = (size_t **) malloc(count * sizeof(size_t *));
+	for (size_t i = 0; i < count; i++) {
+		objects[i] = (size_t *) malloc(size);
+		memset(objects[i], 0, size);
+	}
+
+	double start = now();
+	size_t sum = 0;
+	for (int r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < count; i++) {
+			sum += objects[i][0];
+			objects[i][0] = r;
+		}
+	}
+	double elapsed = now() - start;
+
+	printf("size %lu objects %lu rounds %d: %.2f ns per object (%lu)\n",
+		(unsigned long) size, (unsigned long) count, rounds, elapsed * 1e9 / ((double) rounds * count), (unsigned long) sum);
+
+	for (size_t i = 0; i < count; i++)
+		free(objects[i]);
+	free(objects);
+
+	return 0;
+}
@@ -0,0 +1,104 @@
+// report the tradeoff between internal fragmentation and the number of dedicated subheaps
+// for the size class policies, replaying a trace generated by libmalloctrace
+//
+// usage: sizeclasses < malloctrace.<pid>.<tid>
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "popularity.h"
+#include "sizeclasses.h"
+
+using namespace VAM;
+
+#define MAX_DEDICATED_SIZE	(64 * 1024)
+
+template<class SizeClasses>
+class SizeClassReport {
+
+public:
+
+	SizeClassReport()
+		: _requested(0),
+		  _allocated(0) {
+		memset(_counts, 0, sizeof(_counts));
+	}
+
+	void add(size_t size) {
+		if (size == 0 || size > MAX_DEDICATED_SIZE)
+			return;
+
+		size_t index = SizeClasses::sizeToIndex(size);
+		_counts[index]++;
+		_requested += size;
+		_allocated += SizeClasses::indexToSize(index);
+	}
+
+	void print(const char * name) {
+		int used = 0, popular = 0;
+
+		for (size_t index = 0; index < SizeClasses::NUM_CLASSES; index++) {
+			if (_counts[index] > 0)
+				used++;
+
+			PopularityStats stats = { _counts[index], 0 };
+			if (CumulativePopularity::promote(SizeClasses::indexToSize(index), stats))
+				popular++;
+		}
+
+		printf("%-10s classes %4d used %4d popular %4d requested %12llu allocated %12llu fragmentation %6.2f%%\n",
+			name, (int) SizeClasses::NUM_CLASSES, used, popular, _requested, _allocated,
+			_allocated ? 100.0 * (_allocated - _requested) / _allocated : 0.0);
+	}
+
+private:
+
+	unsigned long long _counts[SizeClasses::NUM_CLASSES];
+	unsigned long long _requested;
+	unsigned long long _allocated;
+
+};
+
+int main(int argc, char * argv[]) {
+	SizeClassReport<LinearSizeClasses<MAX_DEDICATED_SIZE> > linear;
+	SizeClassReport<GeometricSizeClasses<MAX_DEDICATED_SIZE, 1024> > linear1k;
+	SizeClassReport<GeometricSizeClasses<MAX_DEDICATED_SIZE, 64> > geometric;
+
+	char line[256];
+	while (fgets(line, sizeof(line), stdin) != NULL) {
+		unsigned int ever, curr, nmemb, size;
+		char op;
+		void * rv;
+		void * ptr;
+
+		size_t bytes = 0;
+		if (sscanf(line, "%u %u %c", &ever, &curr, &op) != 3)
+			continue;
+
+		switch (op) {
+		case 'm':
+			if (sscanf(line, "%u %u m %p %u", &ever, &curr, &rv, &size) == 4)
+				bytes = size;
+			break;
+		case 'c':
+			if (sscanf(line, "%u %u c %p %u %u", &ever, &curr, &rv, &nmemb, &size) == 5)
+				bytes = (size_t) nmemb * size;
+			break;
+		case 'r':
+			if (sscanf(line, "%u %u r %p %p %u", &ever, &curr, &rv, &ptr, &size) == 5)
+				bytes = size;
+			break;
+		}
+
+		linear.add(bytes);
+		linear1k.add(bytes);
+		geometric.add(bytes);
+	}
+
+	linear.print("linear");
+	linear1k.print("linear-1k");
+	geometric.print("geometric");
+
+	return 0;
+}
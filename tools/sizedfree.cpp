@@ -0,0 +1,71 @@
+// check that objects resized by realloc() can be freed with their new size, run it with LD_PRELOAD set to libvam.so,
+// which aborts at a sized free that names the wrong size class; each size is first allocated often enough to get
+// dedicated subheaps, then objects of it are shrunk and grown by realloc() to sizes of the same and of other size
+// classes and freed with vam_free_sized()
+//
+// usage: sizedfree [largest size] [objects per size]
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void (* free_sized_function)(void *, size_t);
+
+// the object of the given size should hold the byte pattern of its size up to the smaller of the two sizes
+static bool check(unsigned char * ptr, size_t size, size_t filled) {
+	for (size_t i = 0; i < size && i < filled; i++) {
+		if (ptr[i] != (unsigned char) filled)
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char * argv[]) {
+	size_t max_size = argc > 1 ? atol(argv[1]) : 4096;
+	size_t count = argc > 2 ? atol(argv[2]) : 1000;
+
+	if (max_size < 16 || count == 0) {
+		fprintf(stderr, "usage: %s [largest size] [objects per size]\n", argv[0]);
+		return 1;
+	}
+
+	free_sized_function free_sized = (free_sized_function) dlsym(RTLD_DEFAULT, "vam_free_sized");
+	if (free_sized == NULL) {
+		fprintf(stderr, "%s: vam_free_sized() not found, run with LD_PRELOAD set to libvam.so\n", argv[0]);
+		return 1;
+	}
+
+	void ** objects = (void **) malloc(count * sizeof(void *));
+	size_t checked = 0;
+	for (size_t size = 16; size <= max_size; size += size / 8) {
+		// make the size popular
+		for (size_t i = 0; i < count; i++)
+			objects[i] = malloc(size);
+		for (size_t i = 0; i < count; i++)
+			free(objects[i]);
+
+		// shrink by a little and by a lot, keep the size, and grow
+		size_t new_sizes[] = { size - 8, size / 2, size / 5, size, size + 8, size * 2 };
+		for (size_t n = 0; n < sizeof(new_sizes) / sizeof(new_sizes[0]); n++) {
+			size_t new_size = new_sizes[n];
+			for (size_t i = 0; i < count; i++) {
+				objects[i] = malloc(size);
+				memset(objects[i], (unsigned char) size, size);
+				objects[i] = realloc(objects[i], new_size);
+				if (objects[i] == NULL || !check((unsigned char *) objects[i], new_size, size)) {
+					fprintf(stderr, "%s: realloc() from %lu to %lu bytes lost the contents\n",
+						argv[0], (unsigned long) size, (unsigned long) new_size);
+					return 1;
+				}
+			}
+			for (size_t i = 0; i < count; i++)
+				free_sized(objects[i], new_size);
+			checked += count;
+		}
+	}
+	free(objects);
+
+	printf("%lu objects resized and freed with their new size\n", (unsigned long) checked);
+	return 0;
+}
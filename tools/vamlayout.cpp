@@ -0,0 +1,199 @@
+// analyze a heap layout written by vam_layout_dump() or on VAM_LAYOUT_SIGNAL, and report how the partitions,
+// subheaps and low frequency chunks use their memory, their external fragmentation and the resident memory
+// that could be given back to the system
+//
+// usage: vamlayout [-v] <layout file>
+// with -v, every subheap and chunk is listed as well
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+
+#include "libvam.h"
+
+struct TypeTotals {
+	size_t partitions;
+	size_t clusters;
+	size_t free_clusters;
+	size_t discarded_clusters;
+	size_t resident;
+	size_t free_resident;
+};
+
+struct SizeTotals {
+	size_t subheaps;
+	size_t empty_subheaps;
+	size_t objects;
+	size_t free_objects;
+	size_t bytes;
+	size_t resident;
+	size_t empty_resident;
+};
+
+struct BlockTotals {
+	size_t blocks;
+	size_t bytes;
+};
+
+static double percent(double part, double whole) {
+	return whole > 0 ? 100.0 * part / whole : 0.0;
+}
+
+int main(int argc, char * argv[]) {
+	bool verbose = false;
+	int arg = 1;
+	if (arg < argc && strcmp(argv[arg], "-v") == 0) {
+		verbose = true;
+		arg++;
+	}
+
+	if (arg >= argc) {
+		fprintf(stderr, "usage: %s [-v] <layout file>\n", argv[0]);
+		return 1;
+	}
+
+	FILE * file = fopen(argv[arg], "rb");
+	if (file == NULL) {
+		perror(argv[arg]);
+		return 1;
+	}
+
+	struct vam_layout_header header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != VAM_LAYOUT_MAGIC
+		|| header.version != VAM_LAYOUT_VERSION || header.record_size != sizeof(struct vam_layout_record)) {
+		fprintf(stderr, "%s: %s is not a layout dump of this version of vam\n", argv[0], argv[arg]);
+		return 1;
+	}
+	size_t page_kb = header.page_size / 1024;
+
+	std::map<int, TypeTotals> types;
+	std::map<size_t, SizeTotals> sizes;
+	std::map<int, BlockTotals> blocks;
+	size_t chunks = 0, chunk_bytes = 0, chunk_used = 0, chunk_free = 0, chunk_resident = 0, chunk_free_resident = 0;
+	size_t largest_free = 0, sum_largest_free = 0;
+	size_t regions = 0, region_bytes = 0, region_resident = 0;
+	size_t huge = 0, huge_bytes = 0, huge_resident = 0;
+	size_t unknown = 0, unknown_resident = 0;
+
+	struct vam_layout_record r;
+	while (fread(&r, sizeof(r), 1, file) == 1) {
+		switch (r.kind) {
+		case VAM_LAYOUT_PARTITION: {
+			TypeTotals & t = types[r.type];
+			t.partitions++;
+			t.clusters += r.a;
+			t.free_clusters += r.b;
+			t.discarded_clusters += r.c;
+			t.resident += r.resident;
+			t.free_resident += r.d;
+			break;
+		}
+		case VAM_LAYOUT_SUBHEAP: {
+			SizeTotals & s = sizes[r.a];
+			s.subheaps++;
+			s.objects += r.b;
+			s.free_objects += r.c;
+			s.bytes += r.size;
+			s.resident += r.resident;
+			if (r.b == r.c) {
+				s.empty_subheaps++;
+				s.empty_resident += r.resident;
+			}
+			if (verbose)
+				printf("subheap %#lx type %u order %u: %lu of %lu objects of %lu bytes free, %lu KB resident\n",
+					r.address, r.type, r.order, r.c, r.b, r.a, r.resident * page_kb);
+			break;
+		}
+		case VAM_LAYOUT_CHUNK:
+			chunks++;
+			chunk_bytes += r.size;
+			chunk_used += r.a;
+			chunk_free += r.b;
+			chunk_resident += r.resident;
+			chunk_free_resident += r.d;
+			sum_largest_free += r.c;
+			if (r.c > largest_free)
+				largest_free = r.c;
+			if (verbose)
+				printf("chunk %#lx: %lu KB used, %lu KB free, largest free block %lu KB, %lu KB resident\n",
+					r.address, r.a / 1024, r.b / 1024, r.c / 1024, r.resident * page_kb);
+			break;
+		case VAM_LAYOUT_FREE_BLOCKS:
+			blocks[r.order].blocks += r.a;
+			blocks[r.order].bytes += r.b;
+			break;
+		case VAM_LAYOUT_REGION:
+			regions++;
+			region_bytes += r.size;
+			region_resident += r.resident;
+			break;
+		case VAM_LAYOUT_HUGE:
+			huge++;
+			huge_bytes += r.size;
+			huge_resident += r.resident;
+			break;
+		default:
+			unknown++;
+			unknown_resident += r.resident;
+			break;
+		}
+	}
+	fclose(file);
+
+	size_t total_resident = 0;
+	size_t free_cluster_resident = 0;
+	printf("partitions by type\n%6s %10s %10s %10s %10s %10s %14s\n",
+		"type", "partitions", "clusters", "free", "discarded", "rss KB", "free rss KB");
+	for (std::map<int, TypeTotals>::iterator i = types.begin(); i != types.end(); i++) {
+		TypeTotals & t = i->second;
+		printf("%6d %10lu %10lu %10lu %10lu %10lu %14lu\n", i->first, t.partitions, t.clusters, t.free_clusters,
+			t.discarded_clusters, t.resident * page_kb, t.free_resident * page_kb);
+		total_resident += t.resident;
+		free_cluster_resident += t.free_resident;
+	}
+
+	// the free objects of subheaps are external fragmentation as far as other sizes are concerned
+	size_t subheap_free_bytes = 0, subheap_bytes = 0, empty_resident = 0;
+	printf("\ndedicated subheaps by object size\n%8s %8s %8s %10s %10s %8s %10s %12s\n",
+		"size", "subheaps", "empty", "objects", "free", "free %", "rss KB", "empty rss KB");
+	for (std::map<size_t, SizeTotals>::iterator i = sizes.begin(); i != sizes.end(); i++) {
+		SizeTotals & s = i->second;
+		printf("%8lu %8lu %8lu %10lu %10lu %7.1f%% %10lu %12lu\n", i->first, s.subheaps, s.empty_subheaps, s.objects,
+			s.free_objects, percent(s.free_objects, s.objects), s.resident * page_kb, s.empty_resident * page_kb);
+		subheap_free_bytes += s.free_objects * i->first;
+		subheap_bytes += s.bytes;
+		empty_resident += s.empty_resident;
+	}
+
+	// the classic measure: how much of the free memory is not in the largest block, here taken per chunk
+	printf("\nlow frequency chunks\n");
+	printf("  %lu chunks, %lu KB, %lu KB used, %lu KB free, %lu KB resident\n",
+		chunks, chunk_bytes / 1024, chunk_used / 1024, chunk_free / 1024, chunk_resident * page_kb);
+	printf("  largest free block %lu KB, external fragmentation %.1f%%\n",
+		largest_free / 1024, 100.0 - percent(sum_largest_free, chunk_free));
+	printf("%14s %10s %10s\n", "free blocks", "count", "KB");
+	for (std::map<int, BlockTotals>::iterator i = blocks.begin(); i != blocks.end(); i++) {
+		char range[32];
+		snprintf(range, sizeof(range), "< %lu", 1UL << i->first);
+		printf("%14s %10lu %10lu\n", range, i->second.blocks, i->second.bytes / 1024);
+	}
+
+	printf("\nregions: %lu chunks, %lu KB, %lu KB resident\n", regions, region_bytes / 1024, region_resident * page_kb);
+	printf("huge objects: %lu, %lu KB, %lu KB resident\n", huge, huge_bytes / 1024, huge_resident * page_kb);
+	if (unknown > 0)
+		printf("unrecognized clusters: %lu, %lu KB resident\n", unknown, unknown_resident * page_kb);
+	total_resident += huge_resident;
+
+	printf("\nfragmentation: %.1f%% of dedicated subheap space is free objects, %.1f%% of low frequency chunk space is free\n",
+		percent(subheap_free_bytes, subheap_bytes), percent(chunk_free, chunk_bytes));
+
+	// pages of subheaps that are partly free may hold live objects anywhere, so only empty subheaps count
+	size_t reclaimable = free_cluster_resident + empty_resident + chunk_free_resident;
+	printf("reclaimable: %lu KB of %lu KB resident (free clusters %lu KB, empty subheaps %lu KB, free low frequency blocks %lu KB)\n",
+		reclaimable * page_kb, total_resident * page_kb, free_cluster_resident * page_kb,
+		empty_resident * page_kb, chunk_free_resident * page_kb);
+
+	return 0;
+}
@@ -0,0 +1,171 @@
+// watch the heap of a process running with libvam and VAM_STATS_INTERVAL set, the way vmstat watches the system;
+// it maps the statistics segment the process publishes in /dev/shm and never stops or signals the process
+//
+// usage: vamstat [-v] <pid> [interval in seconds] [count]
+// with -v, the size classes with live objects and the partition types in use are listed after every line
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "libvam.h"
+
+// copy a consistent snapshot out of the segment, retrying while the process is writing one
+static bool readSnapshot(const struct vam_stats_segment * segment, struct vam_stats * stats) {
+	for (int tries = 0; tries < 1000; tries++) {
+		unsigned long sequence = segment->sequence;
+		__sync_synchronize();
+		if (sequence % 2 == 0) {
+			memcpy(stats, &segment->stats, sizeof(*stats));
+			__sync_synchronize();
+			if (segment->sequence == sequence)
+				return sequence > 0;
+		}
+		usleep(1000);
+	}
+	return false;
+}
+
+static size_t sum(const size_t * values, size_t n) {
+	size_t total = 0;
+	for (size_t i = 0; i < n; i++)
+		total += values[i];
+	return total;
+}
+
+static void printHeader() {
+	printf("%10s %10s %7s %6s %9s %9s %10s %10s %7s %7s %5s %5s\n",
+		"live KB", "lowfreq KB", "popular", "parts", "rss KB", "discarded",
+		"allocs/s", "frees/s", "purged", "unmaps", "promo", "demo");
+}
+
+// the allocations requested in the size classes, whichever heap served them, and the frees of both heaps
+static void countOperations(const struct vam_stats * stats, size_t * allocs, size_t * frees) {
+	*allocs = 0;
+	*frees = stats->low_freq_frees;
+	for (size_t i = 0; i < stats->num_classes; i++) {
+		*allocs += stats->classes[i].allocs;
+		*frees += stats->classes[i].frees;
+	}
+}
+
+static void printLine(const struct vam_stats * stats, const struct vam_stats * last, double interval, size_t page_size) {
+	size_t live_bytes = 0;
+	size_t num_popular = 0;
+	for (size_t i = 0; i < stats->num_classes; i++) {
+		live_bytes += stats->classes[i].live_bytes;
+		num_popular += stats->classes[i].popular != 0;
+	}
+
+	size_t allocs, frees, last_allocs, last_frees;
+	countOperations(stats, &allocs, &frees);
+	countOperations(last, &last_allocs, &last_frees);
+
+	printf("%10lu %10lu %7lu %6lu %9lu %9lu %10.0f %10.0f %7lu %7lu %5lu %5lu\n",
+		(unsigned long) (live_bytes / 1024),
+		(unsigned long) (stats->low_freq_live_bytes / 1024),
+		(unsigned long) num_popular,
+		(unsigned long) sum(stats->partitions, stats->num_types),
+		(unsigned long) (sum(stats->resident_pages, stats->num_types) * page_size / 1024),
+		(unsigned long) stats->discarded_clusters,
+		(allocs - last_allocs) / interval,
+		(frees - last_frees) / interval,
+		(unsigned long) (stats->purged_clusters - last->purged_clusters),
+		(unsigned long) (stats->released_partitions - last->released_partitions),
+		(unsigned long) (stats->promotions - last->promotions),
+		(unsigned long) (stats->demotions - last->demotions));
+}
+
+static void printDetails(const struct vam_stats * stats, size_t page_size) {
+	printf("  %8s %7s %10s %10s %8s %8s %8s\n", "size", "popular", "live", "live KB", "created", "released", "reused");
+	for (size_t i = 0; i < stats->num_classes; i++) {
+		const struct vam_class_stats * c = &stats->classes[i];
+		if (c->live == 0 && !c->popular)
+			continue;
+		printf("  %8lu %7s %10lu %10lu %8lu %8lu %8lu\n",
+			(unsigned long) c->size, c->popular ? "yes" : "no", (unsigned long) c->live, (unsigned long) (c->live_bytes / 1024),
+			(unsigned long) c->subheaps_created, (unsigned long) c->subheaps_released, (unsigned long) c->subheaps_reused);
+	}
+
+	printf("  %8s %10s %10s %10s\n", "type", "partitions", "clusters", "rss KB");
+	for (size_t type = 0; type < stats->num_types; type++) {
+		if (stats->partitions[type] == 0)
+			continue;
+		printf("  %8lu %10lu %10lu %10lu\n", (unsigned long) type, (unsigned long) stats->partitions[type],
+			(unsigned long) stats->clusters[type], (unsigned long) (stats->resident_pages[type] * page_size / 1024));
+	}
+	printf("\n");
+}
+
+int main(int argc, char * argv[]) {
+	bool verbose = false;
+	int arg = 1;
+	if (arg < argc && strcmp(argv[arg], "-v") == 0) {
+		verbose = true;
+		arg++;
+	}
+
+	if (arg >= argc) {
+		fprintf(stderr, "usage: %s [-v] <pid> [interval in seconds] [count]\n", argv[0]);
+		return 1;
+	}
+
+	int pid = atoi(argv[arg]);
+	double interval = arg + 1 < argc ? atof(argv[arg + 1]) : 1.0;
+	long count = arg + 2 < argc ? atol(argv[arg + 2]) : -1;
+	if (pid <= 0 || interval <= 0) {
+		fprintf(stderr, "usage: %s [-v] <pid> [interval in seconds] [count]\n", argv[0]);
+		return 1;
+	}
+
+	char path[64];
+	snprintf(path, sizeof(path), "/dev/shm/vam.%d", pid);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: cannot open %s, is the process running with libvam and VAM_STATS_INTERVAL set?\n", argv[0], path);
+		return 1;
+	}
+
+	void * space = mmap(NULL, sizeof(struct vam_stats_segment), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (space == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	const struct vam_stats_segment * segment = reinterpret_cast<const struct vam_stats_segment *>(space);
+	if (segment->magic != VAM_STATS_MAGIC || segment->version != VAM_STATS_VERSION) {
+		fprintf(stderr, "%s: %s is not a statistics segment of this version of vam\n", argv[0], path);
+		return 1;
+	}
+
+	// the counters are cumulative, rates are taken between consecutive snapshots, the first line since the start
+	struct vam_stats * stats = new struct vam_stats;
+	struct vam_stats * last = new struct vam_stats;
+	memset(last, 0, sizeof(*last));
+
+	for (long line = 0; count < 0 || line < count; line++) {
+		if (line > 0)
+			usleep((useconds_t) (interval * 1e6));
+
+		if (!readSnapshot(segment, stats)) {
+			fprintf(stderr, "%s: no consistent snapshot in %s\n", argv[0], path);
+			return 1;
+		}
+
+		if (line % 20 == 0 || verbose)
+			printHeader();
+		printLine(stats, last, line > 0 ? interval : 1.0, segment->page_size);
+		if (verbose)
+			printDetails(stats, segment->page_size);
+
+		struct vam_stats * t = last;
+		last = stats;
+		stats = t;
+	}
+
+	return 0;
+}
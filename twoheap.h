@@ -22,24 +22,47 @@ public:
 		}
 		// allocate very large objects from SuperHeap2
 		else {
-			// FIXME: we are making assumptions about how our SuperHeap works here
-			// the size must be page-aligned and larger than the underlying partition size
-			size_t huge_size = size + sizeof(ObjectHeader);
-			if (huge_size <= PartitionSize)
-				huge_size = PartitionSize + PAGE_SIZE;
-			else
-				huge_size = (huge_size + PAGE_SIZE - 1) & PAGE_MASK;
-
-			ObjectHeader * header = reinterpret_cast<ObjectHeader *>(_heap.malloc(huge_size, USE_HEADER_TYPE));
-			if (header != NULL) {
-				header->_size = size;
-				ptr = header->getObject();
-			}
+			ptr = mallocHuge(size, sizeof(ObjectHeader));
 		}
 
 		return ptr;
 	}
 
+	inline void * calloc(size_t size) {
+		if (size <= SuperHeap1::MAX_OBJECT_SIZE)
+			return SuperHeap1::calloc(size);
+
+		// very large objects start a page cluster of their own, which is usually fresh
+		void * ptr = malloc(size);
+		if (ptr != NULL && !_heap.isKnownZero(ObjectHeader::getHeader(ptr)))
+			memset(ptr, 0, size);
+		return ptr;
+	}
+
+	inline void * memalign(size_t alignment, size_t size) {
+		if (size + alignment + SuperHeap1::MIN_PIECE_SIZE <= SuperHeap1::MAX_OBJECT_SIZE)
+			return SuperHeap1::memalign(alignment, size);
+
+		// the object must stay in the first partition of its page cluster, which is the one that knows it
+		if (alignment >= PartitionSize)
+			return NULL;
+
+		return mallocHuge(size, alignment > sizeof(ObjectHeader) ? alignment : sizeof(ObjectHeader));
+	}
+
+	inline bool resize(void * ptr, size_t size) {
+		ObjectHeader * header = ObjectHeader::getHeader(ptr);
+
+		// very large objects keep their size, which tells free() where they come from
+		if (header->_size > SuperHeap1::MAX_OBJECT_SIZE)
+			return size <= header->_size;
+
+		if (size > SuperHeap1::MAX_OBJECT_SIZE)
+			return false;
+
+		return SuperHeap1::resize(ptr, size);
+	}
+
 	inline void free(void * ptr) {
 		ObjectHeader * header = ObjectHeader::getHeader(ptr);
 
@@ -48,7 +71,7 @@ public:
 			SuperHeap1::free(ptr);
 		}
 		else {
-			_heap.free(header);
+			_heap.free(reinterpret_cast<void *>(reinterpret_cast<size_t>(header) & ~(PartitionSize - 1)));
 		}
 	}
 
@@ -56,6 +79,30 @@ private:
 
 	SuperHeap2 _heap;
 
+	// very large objects get a page cluster of their own, aligned to a partition, with the object offset bytes into it and
+	// the header right before it; their size is kept above MAX_OBJECT_SIZE, which tells free() where they come from
+	inline void * mallocHuge(size_t size, size_t offset) {
+		if (size <= SuperHeap1::MAX_OBJECT_SIZE)
+			size = SuperHeap1::MAX_OBJECT_SIZE + 1;
+
+		// FIXME: we are making assumptions about how our SuperHeap works here
+		// the size must be page-aligned and larger than the underlying partition size
+		size_t huge_size = offset + size;
+		if (huge_size <= PartitionSize)
+			huge_size = PartitionSize + PAGE_SIZE;
+		else
+			huge_size = (huge_size + PAGE_SIZE - 1) & PAGE_MASK;
+
+		void * start = _heap.malloc(huge_size, USE_HEADER_TYPE);
+		if (start == NULL)
+			return NULL;
+		assert(reinterpret_cast<size_t>(start) % PartitionSize == 0);
+
+		ObjectHeader * header = ObjectHeader::getHeader(reinterpret_cast<char *>(start) + offset);
+		header->_size = size;
+		return header->getObject();
+	}
+
 };	// end of class TwoHeap
 
 };	// end of namespace VAM
@@ -22,13 +22,23 @@ namespace VAM {
 #include "cachingheap.h"
 #include "freelistreap.h"
 #include "frequencyheap.h"
+#include "groupheap.h"
+#include "layoutdumper.h"
+#include "lifetimeheap.h"
 #include "onesizeheap.h"
 #include "pageclusterheap.h"
 #include "partitionheap.h"
+#include "popularity.h"
 #include "reapbase.h"
+#include "regionheap.h"
 #include "segfitheap.h"
 #include "segsizeheap.h"
+#include "selectsegsizeheap.h"
+#include "serializedheap.h"
+#include "sidemetadataheap.h"
+#include "sizeclasses.h"
 #include "splitcoalesceheap.h"
+#include "threadcachingheap.h"
 #include "twoheap.h"
 
 #include "heaplayers.h"
@@ -52,38 +62,107 @@ class SCHeap : public SuperHeap {};
 // some tunable parameters
 
 #define PARTITION_SIZE		(8 * 1024 * 1024)
-#define MAX_DEDICATED_SIZE	1024
-#define MAX_PAGE_ORDER		5
+#define MAX_DEDICATED_SIZE	(64 * 1024)
+#define MAX_PAGE_ORDER		9
+#define MAX_SEGFIT_SIZE		2048
 
+// the reap of dedicated subheaps, which also decides the order in which freed objects are reused:
+// BitmapCachingReap reuses the hottest ones first, BitmapReap can reuse them in the orders in bitmapreap.h
+#ifndef WORKHORSE_HEAP
 #define WORKHORSE_HEAP		BitmapCachingReap
-//#define WORKHORSE_HEAP		BitmapReap
+//#define WORKHORSE_HEAP		BitmapReap<LOWEST_FIRST>
+//#define WORKHORSE_HEAP		BitmapReap<ADDRESS_ORDERED>
+//#define WORKHORSE_HEAP		BitmapReap<CLUSTERED>
 //#define WORKHORSE_HEAP		BytemapReap
 //#define WORKHORSE_HEAP		FreelistReap
+#endif
+
+// with LARGE_WORKHORSE_HEAP, the size classes above MAX_HOT_SIZE use it instead, so that small objects can be reused
+// hottest first and larger ones, which span more cache lines and pages, in one of the orders of bitmapreap.h
+//#define LARGE_WORKHORSE_HEAP	BitmapReap<CLUSTERED>
+#define MAX_HOT_SIZE		256
+
+// the size classes: GeometricSizeClasses keeps them 8 bytes apart up to LINEAR_CLASS_SIZE and puts four per power
+// of two above, LinearSizeClasses keeps them 8 bytes apart all the way, at the cost of many more classes and subheaps
+#define LINEAR_CLASS_SIZE	1024
+//#define LINEAR_CLASS_SIZE	64
+
+#ifndef SIZE_CLASSES
+#define SIZE_CLASSES		GeometricSizeClasses<MAX_DEDICATED_SIZE, LINEAR_CLASS_SIZE>
+//#define SIZE_CLASSES		LinearSizeClasses<MAX_DEDICATED_SIZE>
+#endif
+
+typedef SIZE_CLASSES SizeClasses;
 
 #ifdef THREAD_SAFE
 template<class SuperHeap>
-class ThreadSafeHeap : public LockedHeap<SpinLockType, SuperHeap> {};
+class ThreadSafeHeap : public SerializedHeap<SpinLockType, SuperHeap> {};
+template<class SizeClasses, class SuperHeap>
+class ThreadCache : public ThreadCachingHeap<SizeClasses, SuperHeap> {};
 #else
 template<class SuperHeap>
 class ThreadSafeHeap : public SuperHeap {};
+template<class SizeClasses, class SuperHeap>
+class ThreadCache : public UncachedHeap<SuperHeap> {};
 #endif
 
-inline bool high_freq_reached(size_t size, size_t count) {
-	return size * count > PAGE_SIZE;
-}
+#define POPULARITY_POLICY	DecayingPopularity
+//#define POPULARITY_POLICY	CumulativePopularity
 
 // here is how our Vam allocator is composed
 
-typedef TheOnePartitionHeap<MAX_PAGE_ORDER + 1, PARTITION_SIZE, PageClusterHeap<TheOneAlignedMmapHeap> > PageSourceHeap;
+// with lifetime segregation, the subheaps of long-lived objects have their own partition types above MAX_PAGE_ORDER
+#ifdef LIFETIME_SEGREGATION
+#define NUM_DEDICATED_TYPES	(2 * MAX_PAGE_ORDER + 1)
+#else
+#define NUM_DEDICATED_TYPES	(MAX_PAGE_ORDER + 1)
+#endif
+
+// the chunks of regions have their own partition types above those of dedicated subheaps
+#define REGION_TYPE_OFFSET	(NUM_DEDICATED_TYPES - 1)
+#define NUM_PARTITION_TYPES	(NUM_DEDICATED_TYPES + MAX_PAGE_ORDER)
+
+typedef TheOnePartitionHeap<NUM_PARTITION_TYPES, PARTITION_SIZE, PageClusterHeap<TheOneAlignedMmapHeap> > PageSourceHeap;
 
-typedef SplitCoalesceHeap<SegFitHeap<MAX_DEDICATED_SIZE * 2>, PageSourceHeap, PARTITION_SIZE> RegularSizeHeap;
+// with out-of-line metadata, dedicated subheaps keep their reap headers and maps in side tables, an eighth of their size
+#ifdef SIDE_METADATA
+typedef SideMetadataHeap<8, PARTITION_SIZE, PageSourceHeap> SubHeapSourceHeap;
+#else
+typedef PageSourceHeap SubHeapSourceHeap;
+#endif
+
+typedef SplitCoalesceHeap<SegFitHeap<MAX_SEGFIT_SIZE>, PageSourceHeap, PARTITION_SIZE> RegularSizeHeap;
 
 typedef ThreadSafeHeap<TwoHeap<RegularSizeHeap, PageSourceHeap, PARTITION_SIZE> > LowFreqHeap;
 
-//typedef SegSizeHeap<MAX_DEDICATED_SIZE, ThreadSafeHeap<CachingHeap<OneSizeHeap<MAX_PAGE_ORDER, WORKHORSE_HEAP, PageSourceHeap> > > > HighFreqHeap;
-typedef SegSizeHeap<MAX_DEDICATED_SIZE, ThreadSafeHeap<OneSizeHeap<MAX_PAGE_ORDER, WORKHORSE_HEAP, PageSourceHeap> > > HighFreqHeap;
+// the dedicated subheaps of all size classes, whose partition types start at TypeOffset
+#ifdef LARGE_WORKHORSE_HEAP
+template<unsigned char TypeOffset>
+class DedicatedSizeHeap : public SelectSegSizeHeap<SizeClasses, UpToSize<MAX_HOT_SIZE>,
+	ThreadSafeHeap<OneSizeHeap<MAX_PAGE_ORDER, WORKHORSE_HEAP, SubHeapSourceHeap, TypeOffset> >,
+	ThreadSafeHeap<OneSizeHeap<MAX_PAGE_ORDER, LARGE_WORKHORSE_HEAP, SubHeapSourceHeap, TypeOffset> > > {};
+#else
+template<unsigned char TypeOffset>
+class DedicatedSizeHeap : public SegSizeHeap<SizeClasses, ThreadSafeHeap<OneSizeHeap<MAX_PAGE_ORDER, WORKHORSE_HEAP, SubHeapSourceHeap, TypeOffset> > > {};
+#endif
+
+//typedef SegSizeHeap<SizeClasses, ThreadSafeHeap<CachingHeap<OneSizeHeap<MAX_PAGE_ORDER, WORKHORSE_HEAP, PageSourceHeap> > > > HighFreqHeap;
+#ifdef LIFETIME_SEGREGATION
+typedef ThreadCache<SizeClasses, DedicatedSizeHeap<0> > ShortLivedHeap;
+typedef ThreadCache<SizeClasses, DedicatedSizeHeap<MAX_PAGE_ORDER> > LongLivedHeap;
+typedef LifetimeHeap<ShortLivedHeap, LongLivedHeap, MAX_PAGE_ORDER> HighFreqHeap;
+#else
+typedef ThreadCache<SizeClasses, DedicatedSizeHeap<0> > HighFreqHeap;
+#endif
+
+typedef FrequencyHeap<SizeClasses, POPULARITY_POLICY, LowFreqHeap, HighFreqHeap> VamHeap;
+
+// a locality group has dedicated subheaps of its own for all sizes up to MAX_DEDICATED_SIZE, LargeHeap serves larger objects
+template<class LargeHeap>
+class VamGroupHeap : public ThreadSafeHeap<GroupHeap<MAX_DEDICATED_SIZE, SegSizeHeap<SizeClasses, OneSizeHeap<MAX_PAGE_ORDER, WORKHORSE_HEAP, SubHeapSourceHeap> >, LargeHeap> > {};
 
-typedef FrequencyHeap<MAX_DEDICATED_SIZE, high_freq_reached, LowFreqHeap, HighFreqHeap> VamHeap;
+// regions bump allocate in 64KB chunks, or larger ones for large objects
+typedef RegionHeap<5, MAX_PAGE_ORDER, PARTITION_SIZE, PageSourceHeap, REGION_TYPE_OFFSET> VamRegionHeap;
 
 
 #ifdef MEMORY_TRACE